@@ -26,6 +26,25 @@
 // License: BSL-1.0
 // https://github.com/yurablok/lua_cArgParse
 // History:
+// v0.4 16-Oct-26   Added std::string_view and const char* support.
+//                  Added LuaCArgParseError, the allocation-free error record.
+//                  Arguments are refilled in place, keeping their storage.
+//                  Added custom allocators and std::pmr support.
+//                  Added std::unordered_map and flat map support.
+//                  Narrow numeric vectors are range checked in blocks.
+//                  Added LuaCArgParseMatrix, a dense row-major matrix.
+//                  Added LuaCArgParseColumns for arrays of records.
+//                  Added records, structs parsed from tables by field names.
+//                  Wrong calls are rejected before any argument is built.
+//                  Added overloads, a std::variant of signature tuples.
+//                  Added cArgBind, lua_CFunction bindings of C++ functions.
+//                  Added cArgPush, values pushed onto the Lua stack.
+//                  Added cArgParseOrRaise.
+//                  Added lazy table views.
+//                  Added cArgForEach.
+//                  Added cArgBindYieldable, parsing in chunks between yields.
+//                  Added snapshots built on other threads, cArgParseAsync.
+//                  Added cArgBindBatch, a call per row of a table.
 // v0.3 28-Jul-20   Added std::vector in std::map support.
 //                  Added std::variant in std::vector and in std::map support.
 // v0.2 23-Jul-20   Added std::map support.
@@ -33,13 +52,23 @@
 
 #pragma once
 #include <limits>
+#include <cstdio>
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <tuple>
+#include <utility>
 #include <optional>
 #include <variant>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <future>
 
 extern "C" {
 #   include "lua.h"
@@ -49,6 +78,314 @@ extern "C" {
 
 namespace utils::lua {
 
+struct LuaCArgParseOptions {
+    // Leave the arguments on the Lua stack instead of popping them.
+    // std::string_view and const char* results point straight into the
+    // Lua-owned strings, which are anchored only by the stack slots of the
+    // arguments. Set this flag whenever such types are parsed, keep the
+    // arguments on the stack for as long as the views are in use and pop
+    // them yourself afterwards (or just return from the C function).
+    bool keepArgs = false;
+    // Memory of the std::pmr containers created while parsing: variant
+    // alternatives and optional values. The containers nested in them and in
+    // the arguments inherit the resource of their parent, so with a tuple
+    // constructed as `args(std::allocator_arg, allocator)` the whole call can
+    // be parsed into a monotonic arena released in one step afterwards.
+    std::pmr::memory_resource* memoryResource = nullptr;
+    // Checks of the records, the structs listing their fields in luaFields().
+    // A missing (nil) field is an error unless its member is std::optional
+    // or skipMissingFields is set, then the member keeps its value (a map
+    // value recycled from another key is reset first). A field that is not
+    // listed is ignored unless rejectExtraFields is set.
+    bool skipMissingFields = false;
+    bool rejectExtraFields = false;
+};
+
+// A dense row-major matrix of numbers, parsed from a table of rows of the same
+// length, e.g. { { 1, 2, 3 }, { 4, 5, 6 } }, into one contiguous buffer.
+template <typename T, typename alloc_t = std::allocator<T>>
+struct LuaCArgParseMatrix {
+    static_assert(std::is_arithmetic_v<T>, "matrix elements must be numbers");
+    using value_type = T;
+    using allocator_type = alloc_t;
+
+    LuaCArgParseMatrix() = default;
+    explicit LuaCArgParseMatrix(const alloc_t& alloc) : data(alloc) {}
+
+    allocator_type get_allocator() const {
+        return data.get_allocator();
+    }
+    T& operator()(const size_t row, const size_t col) {
+        return data[row * cols + col];
+    }
+    const T& operator()(const size_t row, const size_t col) const {
+        return data[row * cols + col];
+    }
+
+    size_t rows = 0;
+    size_t cols = 0;
+    std::vector<T, alloc_t> data;
+};
+
+// A named member of a record. A record is a struct listing its fields in a
+// static function:
+//   struct Options {
+//       int32_t width = 0;
+//       std::optional<std::string> title;
+//       static constexpr auto luaFields() {
+//           return std::make_tuple(
+//               lua::LuaCArgParseField{ "width", &Options::width },
+//               lua::LuaCArgParseField{ "title", &Options::title });
+//       }
+//   };
+// It is parsed from a table like { width = 640, title = "main" }, each field is
+// looked up by its key. The key strings are interned once per Lua state.
+template <typename owner_t, typename member_t>
+struct LuaCArgParseField {
+    const char* name;
+    member_t owner_t::* member;
+};
+template <typename owner_t, typename member_t>
+LuaCArgParseField(const char*, member_t owner_t::*) -> LuaCArgParseField<owner_t, member_t>;
+
+// Parallel columns parsed from an array of records, e.g.
+// { { x = 1, y = 2 }, { x = 3, y = 4 } } into Points{ { 1, 3 }, { 2, 4 } }.
+// Every field of record_t is a std::vector, the known fields of each record
+// are looked up by name and the other ones are ignored.
+template <typename record_t>
+struct LuaCArgParseColumns : record_t {
+    using record_type = record_t;
+};
+
+// Lazy views of a table argument, see below.
+template <typename T>
+struct LuaCArgParseArrayView;
+template <typename key_t, typename value_t>
+struct LuaCArgParseMapView;
+
+// A compact description of a parsing failure. It is filled in without any
+// heap allocations, the text is formatted only on demand.
+struct LuaCArgParseError {
+    enum class Code : uint8_t {
+        None = 0,
+        WrongArgumentsNumber,
+        IntegerExpected,
+        NumberExpected,
+        StringExpected,
+        TableExpected,
+        OutOfRange,
+        IntegerKeyExpected,
+        NonPositiveKey,
+        WrongKeySequence,
+        OptionalMustBeLast,
+        NoSuitableVariant,
+        WrongRowLength,
+        UnknownField,
+        NoMatchingSignature,
+    };
+    // A key of a table on the way from an argument to the offending value.
+    struct Key {
+        int32_t type = LUA_TNONE; // LUA_TNUMBER or LUA_TSTRING
+        bool isInteger = false;
+        lua_Integer integer = 0;
+        lua_Number number = 0.0;
+        // A string key is truncated to fit.
+        bool truncated = false;
+        uint8_t length = 0;
+        char string[22] = {};
+    };
+    static constexpr int32_t maxDepth = 4;
+
+    Code code = Code::None;
+    // Index of the argument, or a relative stack index inside of a table.
+    int32_t argIdx = 0;
+    // lua_type of the offending value.
+    int32_t actualType = LUA_TNONE;
+    // Static name of the expected type for Code::OutOfRange, e.g. "uint16_t".
+    const char* expected = nullptr;
+    // The offending value for Code::OutOfRange and Code::NonPositiveKey.
+    bool isInteger = false;
+    lua_Integer integer = 0;
+    lua_Number number = 0.0;
+    // Nested key path, innermost key first. Only the innermost maxDepth keys
+    // are stored, but depth counts all of them.
+    int32_t rootArgIdx = 0;
+    int32_t depth = 0;
+    Key path[maxDepth];
+
+    bool empty() const {
+        return code == Code::None;
+    }
+    void clear() {
+        code = Code::None;
+        depth = 0;
+    }
+
+    // sink(const char* str, size_t len) is called for each piece of the text.
+    template <typename sink_t>
+    void format(sink_t&& sink) const {
+        const auto text = [&sink](const char* str) {
+            sink(str, std::char_traits<char>::length(str));
+        };
+        // Enough for "%f" of the largest double.
+        char buffer[320];
+        const auto integerText = [&sink, &buffer](const lua_Integer value) {
+            const int32_t len = std::snprintf(buffer, sizeof(buffer), "%lld",
+                static_cast<long long>(value));
+            sink(buffer, std::min(static_cast<size_t>(len), sizeof(buffer) - 1));
+        };
+        const auto numberText = [&sink, &buffer](const lua_Number value) {
+            // The same format as std::to_string.
+            const int32_t len = std::snprintf(buffer, sizeof(buffer), "%f",
+                static_cast<double>(value));
+            sink(buffer, std::min(static_cast<size_t>(len), sizeof(buffer) - 1));
+        };
+        const auto valueText = [&]() {
+            if (isInteger) {
+                integerText(integer);
+            }
+            else {
+                numberText(number);
+            }
+        };
+        switch (code) {
+        case Code::None:
+            return;
+        case Code::WrongArgumentsNumber:
+            text("wrong arguments number");
+            break;
+        case Code::IntegerExpected:
+            text("an integer expected at arg ");
+            integerText(argIdx);
+            break;
+        case Code::NumberExpected:
+            text("a number expected at arg ");
+            integerText(argIdx);
+            break;
+        case Code::StringExpected:
+            text("a string expected at arg ");
+            integerText(argIdx);
+            break;
+        case Code::TableExpected:
+            text("a table expected at arg ");
+            integerText(argIdx);
+            break;
+        case Code::OutOfRange:
+            text("value ");
+            valueText();
+            text(" at arg ");
+            integerText(argIdx);
+            text(" is out of ");
+            text(expected != nullptr ? expected : "type");
+            text(" range");
+            break;
+        case Code::IntegerKeyExpected:
+            text("an integer key expected in table at arg ");
+            integerText(argIdx);
+            break;
+        case Code::NonPositiveKey:
+            text("key value ");
+            valueText();
+            text(" must be > 0 in table at arg ");
+            integerText(argIdx);
+            break;
+        case Code::WrongKeySequence:
+            text("wrong key sequence in table at arg ");
+            integerText(argIdx);
+            break;
+        case Code::OptionalMustBeLast:
+            text("optional must be last");
+            break;
+        case Code::NoSuitableVariant:
+            text("no suitable variant");
+            break;
+        case Code::WrongRowLength:
+            text("wrong row length in table at arg ");
+            integerText(argIdx);
+            break;
+        case Code::UnknownField:
+            text("unknown field in table at arg ");
+            integerText(argIdx);
+            break;
+        case Code::NoMatchingSignature:
+            text("no matching signature");
+            break;
+        }
+        if (depth == 0) {
+            return;
+        }
+        text(" in arg ");
+        integerText(rootArgIdx);
+        if (depth > maxDepth) {
+            text("[...]");
+        }
+        for (int32_t i = std::min(depth, maxDepth) - 1; i >= 0; --i) {
+            const Key& key = path[i];
+            if (key.type == LUA_TSTRING) {
+                text("[\"");
+                sink(key.string, key.length);
+                text(key.truncated ? "...\"]" : "\"]");
+            }
+            else {
+                text("[");
+                if (key.isInteger) {
+                    integerText(key.integer);
+                }
+                else {
+                    numberText(key.number);
+                }
+                text("]");
+            }
+        }
+    }
+    void toString(std::string& str) const {
+        str.clear();
+        format([&str](const char* piece, const size_t len) {
+            str.append(piece, len);
+        });
+    }
+    std::string toString() const {
+        std::string str;
+        toString(str);
+        return str;
+    }
+};
+
+// How cArgForEach ended.
+enum class LuaCArgForEachResult : uint8_t {
+    // All the elements are visited.
+    Completed = 0,
+    // The callback returned false.
+    Stopped,
+    // A wrong element or not a table, see the error.
+    Failed,
+};
+
+// The arguments of args_t copied out of the Lua state by cArgSnapshot on the
+// Lua thread, to be built by cArgBuild on any thread. Only what args_t asks
+// for is copied, already checked: the numbers, the offsets and lengths of the
+// strings, the sizes and the keys of the tables, the presence of the fields
+// and the chosen alternatives, in the depth-first order. The bytes of the
+// strings are packed together.
+template <typename args_t>
+struct LuaCArgParseSnapshot {
+    union Cell {
+        lua_Integer integer = 0;
+        lua_Number number;
+        size_t size;
+    };
+
+    std::vector<Cell> cells;
+    std::string bytes;
+};
+
+// The arguments and the error of an asynchronous parse, see cArgParseAsync.
+template <typename args_t>
+struct LuaCArgParseResult {
+    args_t args;
+    LuaCArgParseError error;
+};
+
 namespace details {
 
 namespace {
@@ -63,23 +400,27 @@ namespace {
             }
             foreach_t<Index - 1, TCallback, TParams...>::foreach_(callback, tuple);
         }
-        static void foreach_(TCallback& callback, std::variant<TParams...>& variant) {
+        static void foreach_(TCallback& callback, std::variant<TParams...>& variant,
+                const uint64_t candidates) {
             const size_t idx = sizeof...(TParams) - Index;
             // explicit operator call due to the template parameter
             // https://stackoverflow.com/a/1762137
             using arg_t = std::decay_t<decltype(std::get<idx>(variant))>;
-            if (callback.template operator()<arg_t>(variant)) {
+            if (((candidates >> idx) & 1) != 0
+                    && callback.template operator()<arg_t>(variant)) {
                 // first match - no sense to continue
                 return;
             }
-            foreach_t<Index - 1, TCallback, TParams...>::foreach_(callback, variant);
+            foreach_t<Index - 1, TCallback, TParams...>::foreach_(
+                callback, variant, candidates);
         }
     };
     template<typename TCallback, typename ...TParams>
     struct foreach_t<0, TCallback, TParams...> {
         static void foreach_(TCallback& /*callback*/, std::tuple<TParams...>& /*tuple*/) {
         }
-        static void foreach_(TCallback& /*callback*/, std::variant<TParams...>& /*tuple*/) {
+        static void foreach_(TCallback& /*callback*/, std::variant<TParams...>& /*tuple*/,
+                const uint64_t /*candidates*/) {
         }
     };
 }
@@ -89,9 +430,13 @@ void foreach_(TCallback& callback, std::tuple<TParams...>& tuple) {
     // std::apply can't be interrupted
     foreach_t<sizeof...(TParams), TCallback, TParams...>::foreach_(callback, tuple);
 }
+// Visits only the alternatives whose bits are set in candidates.
 template<typename TCallback, typename ...TParams>
-void foreach_(TCallback& callback, std::variant<TParams...>& variant) {
-    foreach_t<sizeof...(TParams), TCallback, TParams...>::foreach_(callback, variant);
+void foreach_(TCallback& callback, std::variant<TParams...>& variant,
+        const uint64_t candidates) {
+    static_assert(sizeof...(TParams) <= 64, "too many alternatives in variant");
+    foreach_t<sizeof...(TParams), TCallback, TParams...>::foreach_(
+        callback, variant, candidates);
 }
 
 template <typename>
@@ -109,52 +454,421 @@ struct is_variant : std::false_type {};
 template <typename ...T>
 struct is_variant<std::variant<T...>> : std::true_type {};
 
+// std::string_view and const char* point straight into the Lua-owned string.
+template <typename>
+struct is_string : std::false_type {};
+template <typename traits_t, typename alloc_t>
+struct is_string<std::basic_string<char, traits_t, alloc_t>> : std::true_type {};
+template <>
+struct is_string<std::string_view> : std::true_type {};
+template <>
+struct is_string<const char*> : std::true_type {};
+
+template <typename>
+struct is_pair : std::false_type {};
+template <typename first_t, typename second_t>
+struct is_pair<std::pair<first_t, second_t>> : std::true_type {};
+
+// A vector of pairs is a flat map, see is_map.
 template <typename>
 struct is_vector : std::false_type {};
-template <typename T>
-struct is_vector<std::vector<T>> : std::true_type {};
+template <typename T, typename alloc_t>
+struct is_vector<std::vector<T, alloc_t>> : std::bool_constant<!is_pair<T>::value> {};
+
+template <typename key_t, typename value_t>
+struct map_types : std::true_type {
+    using key_type = key_t;
+    using mapped_type = value_t;
+};
 
 template <typename>
 struct is_map : std::false_type {};
+template <typename key_t, typename value_t, typename compare_t, typename alloc_t>
+struct is_map<std::map<key_t, value_t, compare_t, alloc_t>>
+    : map_types<key_t, value_t> {};
+template <typename key_t, typename value_t, typename hash_t, typename equal_t,
+    typename alloc_t>
+struct is_map<std::unordered_map<key_t, value_t, hash_t, equal_t, alloc_t>>
+    : map_types<key_t, value_t> {};
+template <typename key_t, typename value_t, typename alloc_t>
+struct is_map<std::vector<std::pair<key_t, value_t>, alloc_t>>
+    : map_types<key_t, value_t> {};
+
+template <typename>
+struct is_matrix : std::false_type {};
+template <typename T, typename alloc_t>
+struct is_matrix<LuaCArgParseMatrix<T, alloc_t>> : std::true_type {};
+
+template <typename>
+struct is_columns : std::false_type {};
+template <typename record_t>
+struct is_columns<LuaCArgParseColumns<record_t>> : std::true_type {};
+
+template <typename>
+struct is_view : std::false_type {};
+template <typename T>
+struct is_view<LuaCArgParseArrayView<T>> : std::true_type {};
 template <typename key_t, typename value_t>
-struct is_map<std::map<key_t, value_t>> : std::true_type {};
+struct is_view<LuaCArgParseMapView<key_t, value_t>> : std::true_type {};
+
+// A view, or a signature with a view, refers to its table on the stack.
+template <typename T>
+struct has_views : is_view<T> {};
+template <typename ...args_t>
+struct has_views<std::tuple<args_t...>> : std::bool_constant<(is_view<args_t>::value || ...)> {};
+
+// A struct with the static luaFields() function, see LuaCArgParseField.
+template <typename, typename = void>
+struct is_record : std::false_type {};
+template <typename T>
+struct is_record<T, std::void_t<decltype(T::luaFields())>>
+    : std::bool_constant<!is_columns<T>::value> {};
+
+template <typename>
+struct is_unordered_map : std::false_type {};
+template <typename key_t, typename value_t, typename hash_t, typename equal_t,
+    typename alloc_t>
+struct is_unordered_map<std::unordered_map<key_t, value_t, hash_t, equal_t, alloc_t>>
+    : std::true_type {};
+
+// A vector of key-value pairs sorted by key.
+template <typename>
+struct is_flat_map : std::false_type {};
+template <typename key_t, typename value_t, typename alloc_t>
+struct is_flat_map<std::vector<std::pair<key_t, value_t>, alloc_t>> : std::true_type {};
 
 template <typename T>
 struct always_false : std::false_type {};
 
+// Lua value classes told apart by a single lua_type call
+// (plus lua_isinteger for numbers).
+enum class LuaTag : uint8_t {
+    None = 0,
+    Nil,
+    Boolean,
+    Integer,
+    Float,
+    String,
+    Table,
+    Other,
+    Count
+};
+
+inline LuaTag luaTag(lua_State* lua, const int32_t idx) {
+    switch (lua_type(lua, idx)) {
+    case LUA_TNONE:
+        return LuaTag::None;
+    case LUA_TNIL:
+        return LuaTag::Nil;
+    case LUA_TBOOLEAN:
+        return LuaTag::Boolean;
+    case LUA_TNUMBER:
+        return lua_isinteger(lua, idx) ? LuaTag::Integer : LuaTag::Float;
+    case LUA_TSTRING:
+        return LuaTag::String;
+    case LUA_TTABLE:
+        return LuaTag::Table;
+    default:
+        return LuaTag::Other;
+    }
+}
+
+constexpr uint32_t luaTagBit(const LuaTag tag) {
+    return 1u << static_cast<uint32_t>(tag);
+}
+
+template <typename ...args_t>
+constexpr uint32_t acceptedVariantTags(std::variant<args_t...>*);
+
+// The set of LuaTag bits that a value of type T can be parsed from.
+template <typename T>
+constexpr uint32_t acceptedLuaTags() {
+    if constexpr (std::is_integral_v<T>) {
+        return luaTagBit(LuaTag::Integer);
+    }
+    else if constexpr (std::is_floating_point_v<T>) {
+        return luaTagBit(LuaTag::Float);
+    }
+    else if constexpr (is_string<T>::value) {
+        return luaTagBit(LuaTag::String);
+    }
+    else if constexpr (is_vector<T>::value || is_map<T>::value || is_matrix<T>::value
+            || is_columns<T>::value || is_record<T>::value || is_view<T>::value) {
+        return luaTagBit(LuaTag::Table);
+    }
+    else if constexpr (is_optional<T>::value) {
+        return acceptedLuaTags<typename T::value_type>() | luaTagBit(LuaTag::None);
+    }
+    else if constexpr (is_variant<T>::value) {
+        return acceptedVariantTags(static_cast<T*>(nullptr));
+    }
+    else {
+        // std::nullptr_t is never parsed, it only occupies a variant.
+        return 0;
+    }
+}
+
+template <typename ...args_t>
+constexpr uint32_t acceptedVariantTags(std::variant<args_t...>*) {
+    return (acceptedLuaTags<args_t>() | ... | 0u);
+}
+
+// For each LuaTag, a bit mask of the variant alternatives that may accept it.
+template <typename ...args_t>
+constexpr std::array<uint64_t, static_cast<size_t>(LuaTag::Count)> variantCandidates() {
+    std::array<uint64_t, static_cast<size_t>(LuaTag::Count)> table = {};
+    constexpr uint32_t accepted[] = { acceptedLuaTags<args_t>()... };
+    for (size_t tag = 0; tag < table.size(); ++tag) {
+        for (size_t idx = 0; idx < sizeof...(args_t); ++idx) {
+            if (((accepted[idx] >> tag) & 1) != 0) {
+                table[tag] |= uint64_t(1) << idx;
+            }
+        }
+    }
+    return table;
+}
+
 struct LuaCArgParseMeta {
     lua_State* lua = nullptr;
-    std::string* errorStr = nullptr;
+    LuaCArgParseError* error = nullptr;
+    std::pmr::memory_resource* memoryResource = nullptr;
+    bool skipMissingFields = false;
+    bool rejectExtraFields = false;
     int32_t argsNumber = 0;
     int32_t argIdx = 0;
 };
 
+// Where a parse split into chunks stopped, see processTupleChunk.
+struct LuaCArgParseCursor {
+    // The next argument to parse, the previous ones are done.
+    int32_t argIdx = 1;
+    // The number of the converted elements of the vector argument argIdx.
+    lua_Unsigned count = 0;
+    // The border of the vector argument argIdx and its entries once counted,
+    // see findSequenceRoom.
+    lua_Unsigned length = 0;
+    lua_Unsigned entries = 0;
+    // The vector argument argIdx is being traversed, its last visited key is
+    // on the top of the stack.
+    bool isInTable = false;
+};
+
+template <typename T>
+constexpr bool usesMemoryResource() {
+    return std::uses_allocator_v<T, std::pmr::polymorphic_allocator<std::byte>>;
+}
+
+// A new object made by the parser itself (a variant alternative, an optional
+// value, a map key). std::pmr containers get the memory resource of the call,
+// the nested ones inherit it from their parent container.
+template <typename T>
+T makeValue(const LuaCArgParseMeta& meta) {
+    if constexpr (usesMemoryResource<T>()) {
+        if (meta.memoryResource != nullptr) {
+            return T(typename T::allocator_type(meta.memoryResource));
+        }
+    }
+    return T();
+}
+
+// Whether an object that is already there can be refilled in place.
+template <typename T>
+bool isReusable(const LuaCArgParseMeta& meta, const T& value) {
+    if constexpr (usesMemoryResource<T>()) {
+        return meta.memoryResource == nullptr
+            || value.get_allocator().resource() == meta.memoryResource;
+    }
+    return true;
+}
+
+template <typename arg_t>
+constexpr const char* typeName() {
+    if constexpr (std::is_floating_point_v<arg_t>) {
+        return sizeof(arg_t) == sizeof(float) ? "float" : "double";
+    }
+    else {
+        constexpr const char* signedNames[] = { "int8_t", "int16_t", "int32_t", "int64_t" };
+        constexpr const char* unsignedNames[] = { "uint8_t", "uint16_t", "uint32_t", "uint64_t" };
+        constexpr size_t idx = sizeof(arg_t) == 1 ? 0 : sizeof(arg_t) == 2 ? 1
+            : sizeof(arg_t) == 4 ? 2 : 3;
+        return std::is_unsigned_v<arg_t> ? unsignedNames[idx] : signedNames[idx];
+    }
+}
+
+inline void setError(LuaCArgParseMeta& meta, const LuaCArgParseError::Code code,
+        const int32_t valueIdx) {
+    LuaCArgParseError& error = *meta.error;
+    error.code = code;
+    error.argIdx = meta.argIdx;
+    error.actualType = lua_type(meta.lua, valueIdx);
+    error.expected = nullptr;
+    error.depth = 0;
+}
+
+// Called by a table on the way back from a failed nested value.
+inline void pushErrorKey(LuaCArgParseMeta& meta, const int32_t keyIdx) {
+    LuaCArgParseError& error = *meta.error;
+    if (meta.argIdx > 0) {
+        error.rootArgIdx = meta.argIdx;
+    }
+    if (error.depth < LuaCArgParseError::maxDepth) {
+        LuaCArgParseError::Key& key = error.path[error.depth];
+        key.type = lua_type(meta.lua, keyIdx);
+        if (key.type == LUA_TSTRING) {
+            size_t len = 0;
+            const char* str = lua_tolstring(meta.lua, keyIdx, &len);
+            key.truncated = len > sizeof(key.string);
+            key.length = static_cast<uint8_t>(std::min(len, sizeof(key.string)));
+            std::char_traits<char>::copy(key.string, str, key.length);
+        }
+        else {
+            key.isInteger = static_cast<bool>(lua_isinteger(meta.lua, keyIdx));
+            key.integer = lua_tointeger(meta.lua, keyIdx);
+            key.number = lua_tonumber(meta.lua, keyIdx);
+        }
+    }
+    ++error.depth;
+}
+
+template <typename arg_t>
+constexpr bool integerFits(const lua_Integer integer64) {
+    if constexpr (std::is_unsigned_v<arg_t>) {
+        return integer64 >= 0
+            && static_cast<lua_Unsigned>(integer64) <= std::numeric_limits<arg_t>::max();
+    }
+    else {
+        return integer64 >= std::numeric_limits<arg_t>::lowest()
+            && integer64 <= std::numeric_limits<arg_t>::max();
+    }
+}
+
+template <typename arg_t>
+constexpr bool numberFits(const lua_Number float64) {
+    return !(float64 < std::numeric_limits<arg_t>::lowest()
+        || float64 > std::numeric_limits<arg_t>::max());
+}
+
+// Numeric reads with as few stack index resolutions as the strictness allows:
+// lua_tointegerx/lua_tonumberx would also convert numeric strings, and the
+// integer and float subtypes are told apart. lua_isinteger already implies
+// a number, so an integer costs two calls. A float still costs three: no call
+// of the public API tells a float from a numeric string or an integer and
+// gives its value at once.
+inline bool readInteger(lua_State* lua, const int32_t idx, lua_Integer& integer64) {
+    if (static_cast<bool>(lua_isinteger(lua, idx)) == false) {
+        return false;
+    }
+    integer64 = lua_tointegerx(lua, idx, nullptr);
+    return true;
+}
+
+inline bool readNumber(lua_State* lua, const int32_t idx, lua_Number& float64) {
+    if (lua_type(lua, idx) != LUA_TNUMBER
+            || static_cast<bool>(lua_isinteger(lua, idx)) == true) {
+        return false;
+    }
+    float64 = lua_tonumberx(lua, idx, nullptr);
+    return true;
+}
+
+template <typename ...args_t>
+bool probeVariant(lua_State* lua, const int32_t idx, std::variant<args_t...>*);
+
+// Tells without building anything whether a value of type T can be parsed
+// from the value at idx. A table is judged by its first entry only, so this
+// is a quick filter of the container alternatives of a variant: a table that
+// fails it can't be parsed as T, one that passes it is then parsed in full.
+template <typename T>
+bool probeValue(lua_State* lua, const int32_t idx) {
+    if constexpr (std::is_integral_v<T>) {
+        lua_Integer integer64 = 0;
+        return readInteger(lua, idx, integer64) && integerFits<T>(integer64);
+    }
+    else if constexpr (std::is_floating_point_v<T>) {
+        lua_Number float64 = 0;
+        return readNumber(lua, idx, float64) && numberFits<T>(float64);
+    }
+    else if constexpr (is_string<T>::value) {
+        return lua_type(lua, idx) == LUA_TSTRING;
+    }
+    else if constexpr (is_record<T>::value) {
+        // The fields are not known to be there until looked up.
+        return lua_type(lua, idx) == LUA_TTABLE;
+    }
+    else if constexpr (is_vector<T>::value || is_map<T>::value || is_matrix<T>::value
+            || is_columns<T>::value) {
+        if (lua_type(lua, idx) != LUA_TTABLE) {
+            return false;
+        }
+        const int32_t tableIdx = lua_absindex(lua, idx);
+        lua_pushnil(lua);
+        if (lua_next(lua, tableIdx) == 0) {
+            // An empty table suits any container.
+            return true;
+        }
+        // key at -2 and value at -1
+        bool ok = false;
+        if constexpr (is_vector<T>::value) {
+            lua_Integer keyValue = 0;
+            ok = readInteger(lua, -2, keyValue) && keyValue >= 1
+                && probeValue<typename T::value_type>(lua, -1);
+        }
+        else if constexpr (is_matrix<T>::value) {
+            // The first row is probed as a vector.
+            lua_Integer keyValue = 0;
+            ok = readInteger(lua, -2, keyValue) && keyValue >= 1
+                && probeValue<std::vector<typename T::value_type>>(lua, -1);
+        }
+        else if constexpr (is_columns<T>::value) {
+            lua_Integer keyValue = 0;
+            ok = readInteger(lua, -2, keyValue) && keyValue >= 1
+                && lua_type(lua, -1) == LUA_TTABLE;
+        }
+        else {
+            ok = probeValue<typename is_map<T>::key_type>(lua, -2)
+                && probeValue<typename is_map<T>::mapped_type>(lua, -1);
+        }
+        lua_pop(lua, 2);
+        return ok;
+    }
+    else if constexpr (is_variant<T>::value) {
+        return probeVariant(lua, idx, static_cast<T*>(nullptr));
+    }
+    else {
+        return false;
+    }
+}
+
+template <typename ...args_t, size_t ...altIdx>
+bool probeAlternatives(lua_State* lua, const int32_t idx, const uint64_t candidates,
+        std::index_sequence<altIdx...>) {
+    return ((((candidates >> altIdx) & 1) != 0 && probeValue<args_t>(lua, idx)) || ...);
+}
+
+template <typename ...args_t>
+bool probeVariant(lua_State* lua, const int32_t idx, std::variant<args_t...>*) {
+    static constexpr auto candidates = variantCandidates<args_t...>();
+    return probeAlternatives<args_t...>(lua, idx,
+        candidates[static_cast<size_t>(luaTag(lua, idx))],
+        std::index_sequence_for<args_t...>());
+}
+
 template <typename arg_t, typename res_t>
 bool processInteger(LuaCArgParseMeta& meta, res_t& res, const bool quiet) {
-    if (static_cast<bool>(lua_isinteger(meta.lua, meta.argIdx)) == false
-            || lua_type(meta.lua, meta.argIdx) != LUA_TNUMBER) {
+    lua_Integer integer64 = 0;
+    if (!readInteger(meta.lua, meta.argIdx, integer64)) {
         if (!quiet) {
-            *meta.errorStr = "an integer expected at arg ";
-            *meta.errorStr += std::to_string(meta.argIdx);
+            setError(meta, LuaCArgParseError::Code::IntegerExpected, meta.argIdx);
             meta.argIdx = INT32_MIN;
         }
         return false;
     }
-    const lua_Integer integer64 = lua_tointeger(meta.lua, meta.argIdx);
-    if (integer64 < std::numeric_limits<arg_t>::lowest()
-            || integer64 > std::numeric_limits<arg_t>::max()) {
+    if (!integerFits<arg_t>(integer64)) {
         if (!quiet) {
-            *meta.errorStr = "value ";
-            *meta.errorStr += std::to_string(integer64);
-            *meta.errorStr += " at arg ";
-            *meta.errorStr += std::to_string(meta.argIdx);
-            *meta.errorStr += " is out of ";
-            if constexpr (std::is_unsigned_v<arg_t>) {
-                *meta.errorStr += "u";
-            }
-            *meta.errorStr += "int";
-            *meta.errorStr += std::to_string(sizeof(arg_t) * 8);
-            *meta.errorStr += "_t range";
+            setError(meta, LuaCArgParseError::Code::OutOfRange, meta.argIdx);
+            meta.error->expected = typeName<arg_t>();
+            meta.error->isInteger = true;
+            meta.error->integer = integer64;
             meta.argIdx = INT32_MIN;
         }
         return false;
@@ -165,31 +879,20 @@ bool processInteger(LuaCArgParseMeta& meta, res_t& res, const bool quiet) {
 
 template <typename arg_t, typename res_t>
 bool processFloat(LuaCArgParseMeta& meta, res_t& res, const bool quiet) {
-    if (static_cast<bool>(lua_isinteger(meta.lua, meta.argIdx)) == true
-            || lua_type(meta.lua, meta.argIdx) != LUA_TNUMBER) {
+    lua_Number float64 = 0;
+    if (!readNumber(meta.lua, meta.argIdx, float64)) {
         if (!quiet) {
-            *meta.errorStr = "a number expected at arg ";
-            *meta.errorStr += std::to_string(meta.argIdx);
+            setError(meta, LuaCArgParseError::Code::NumberExpected, meta.argIdx);
             meta.argIdx = INT32_MIN;
         }
         return false;
     }
-    const lua_Number float64 = lua_tonumber(meta.lua, meta.argIdx);
-    if (float64 < std::numeric_limits<arg_t>::lowest()
-            || float64 > std::numeric_limits<arg_t>::max()) {
+    if (!numberFits<arg_t>(float64)) {
         if (!quiet) {
-            *meta.errorStr = "value ";
-            *meta.errorStr += std::to_string(float64);
-            *meta.errorStr += " at arg ";
-            *meta.errorStr += std::to_string(meta.argIdx);
-            *meta.errorStr += " is out of ";
-            if constexpr (sizeof(res_t) == sizeof(float)) {
-                *meta.errorStr += "float";
-            }
-            else {
-                *meta.errorStr += "double";
-            }
-            *meta.errorStr += " range";
+            setError(meta, LuaCArgParseError::Code::OutOfRange, meta.argIdx);
+            meta.error->expected = typeName<arg_t>();
+            meta.error->isInteger = false;
+            meta.error->number = float64;
             meta.argIdx = INT32_MIN;
         }
         return false;
@@ -198,12 +901,11 @@ bool processFloat(LuaCArgParseMeta& meta, res_t& res, const bool quiet) {
     return true;
 }
 
-template <typename res_t>
+template <typename arg_t, typename res_t>
 bool processString(LuaCArgParseMeta& meta, res_t& res, const bool quiet) {
     if (lua_type(meta.lua, meta.argIdx) != LUA_TSTRING) {
         if (!quiet) {
-            *meta.errorStr = "a string expected at arg ";
-            *meta.errorStr += std::to_string(meta.argIdx);
+            setError(meta, LuaCArgParseError::Code::StringExpected, meta.argIdx);
             meta.argIdx = INT32_MIN;
         }
         return false;
@@ -212,13 +914,36 @@ bool processString(LuaCArgParseMeta& meta, res_t& res, const bool quiet) {
     const char* str = lua_tolstring(meta.lua, meta.argIdx, &len);
     if (str == nullptr) {
         if (!quiet) {
-            *meta.errorStr = "a string expected at arg ";
-            *meta.errorStr += std::to_string(meta.argIdx);
+            setError(meta, LuaCArgParseError::Code::StringExpected, meta.argIdx);
             meta.argIdx = INT32_MIN;
         }
         return false;
     }
-    res = std::move(std::string(str, len));
+    if constexpr (std::is_same_v<arg_t, const char*>) {
+        // Lua strings are always zero-terminated.
+        res = str;
+    }
+    else if constexpr (std::is_same_v<arg_t, std::string_view>) {
+        if constexpr (is_variant<res_t>::value) {
+            res.template emplace<arg_t>(str, len);
+        }
+        else {
+            res = arg_t(str, len);
+        }
+    }
+    else if constexpr (is_variant<res_t>::value) {
+        // Keep the capacity of a string that is already there.
+        arg_t* existing = std::get_if<arg_t>(&res);
+        if (existing != nullptr && isReusable(meta, *existing)) {
+            existing->assign(str, len);
+        }
+        else {
+            res.template emplace<arg_t>(makeValue<arg_t>(meta)).assign(str, len);
+        }
+    }
+    else {
+        res.assign(str, len);
+    }
     return true;
 }
 
@@ -226,9 +951,12 @@ template <typename arg_t>
 bool processOptional(LuaCArgParseMeta& meta, std::optional<arg_t>& optional) {
     if (meta.argIdx > meta.argsNumber) {
         --meta.argIdx;
+        optional.reset();
         return true;
     }
-    optional = arg_t();
+    if (!optional.has_value() || !isReusable(meta, *optional)) {
+        optional.emplace(makeValue<arg_t>(meta));
+    }
     bool ok = false;
     if constexpr (std::is_integral_v<arg_t>) {
         ok = processInteger<arg_t>(meta, optional.value(), false);
@@ -236,8 +964,8 @@ bool processOptional(LuaCArgParseMeta& meta, std::optional<arg_t>& optional) {
     else if constexpr (std::is_floating_point_v<arg_t>) {
         ok = processFloat<arg_t>(meta, optional.value(), false);
     }
-    else if constexpr (std::is_same_v<arg_t, std::string>) {
-        ok = processString(meta, optional.value(), false);
+    else if constexpr (is_string<arg_t>::value) {
+        ok = processString<arg_t>(meta, optional.value(), false);
     }
     else if constexpr (is_variant<arg_t>::value) {
         ok = processVariant(meta, optional.value());
@@ -252,397 +980,2897 @@ bool processOptional(LuaCArgParseMeta& meta, std::optional<arg_t>& optional) {
     return true;
 }
 
-template <typename arg_t, typename res_t>
-bool processVector(LuaCArgParseMeta& meta, res_t& res, const bool quietInit) {
-    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
-        if (!quietInit) {
-            *meta.errorStr = "a table expected at arg ";
-            *meta.errorStr += std::to_string(meta.argIdx);
-            meta.argIdx = INT32_MIN;
-        }
-        return false;
-    }
-    bool ok = true;
-    lua_pushnil(meta.lua);
-    std::map<int32_t, arg_t> map;
-    bool quiet = quietInit;
-    while (lua_next(meta.lua, -2) != 0) {
-        if (!ok) {
-            lua_pop(meta.lua, 1);
-            continue;
-        }
-        do {
-            // key at -2 and value at -1
-            const int32_t keyType = lua_type(meta.lua, -2);
-            if (keyType != LUA_TNUMBER) {
-                *meta.errorStr = "an integer key expected in table at arg ";
-                *meta.errorStr += std::to_string(meta.argIdx);
-                ok = false;
-                break;
-            }
-            const lua_Number keyValueF = lua_tonumber(meta.lua, -2);
-            lua_Number integralPart;
-            if (std::modf(keyValueF, &integralPart) != 0.0) {
-                *meta.errorStr = "an integer key expected in table at arg ";
-                *meta.errorStr += std::to_string(meta.argIdx);
-                ok = false;
-                break;
-            }
-            const int32_t keyValue = static_cast<int32_t>(integralPart);
-            if (keyValue < 1) {
-                *meta.errorStr = "key value ";
-                *meta.errorStr += std::to_string(keyValue);
-                *meta.errorStr += " must be > 0 in table at arg ";
-                *meta.errorStr += std::to_string(meta.argIdx);
-                ok = false;
-                break;
-            }
-            LuaCArgParseMeta valueMeta;
-            valueMeta.lua = meta.lua;
-            valueMeta.errorStr = meta.errorStr;
-            valueMeta.argIdx = -1;
-            arg_t arg;
-            if constexpr (std::is_integral_v<arg_t>) {
-                ok = processInteger<arg_t>(valueMeta, arg, quiet);
-            }
-            else if constexpr (std::is_floating_point_v<arg_t>) {
-                ok = processFloat<arg_t>(valueMeta, arg, quiet);
-            }
-            else if constexpr (std::is_same_v<arg_t, std::string>) {
-                ok = processString(valueMeta, arg, quiet);
-            }
-            else if constexpr (is_variant<arg_t>::value) {
-                ok = processVariant(valueMeta, arg);
-            }
-            else if constexpr (is_optional<arg_t>::value) {
-                static_assert(always_false<arg_t>::value, "optional is not allowed in vector");
-            }
-            else if constexpr (is_tuple<arg_t>::value) {
-                static_assert(always_false<arg_t>::value, "tuple is not allowed in vector");
-            }
-            else {
-                static_assert(always_false<arg_t>::value, "prohibited combination");
-            }
-            // If in variant && error && first iteration.
-            if (quietInit && !ok && map.empty()) {
-                // Revert.
-                lua_settable(meta.lua, -3);
-                return false;
-            }
-            quiet = false;
-            if (ok) {
-                map[keyValue] = std::move(arg);
-            }
-        } while (false);
-        // Remove the value with keeping the key for the next iteration.
-        lua_pop(meta.lua, 1);
-    }
-    if (!meta.errorStr->empty()) {
-        meta.argIdx = INT32_MIN;
-        return false;
-    }
-    std::vector<arg_t> vector;
-    vector.reserve(map.size());
-    // std::transform is 5% faster but does not allow movement.
-    // Maybe there is some other way?
-    int32_t maxIdx = 0;
-    for (auto& it : map) {
-        vector.push_back(std::move(it.second));
-        maxIdx = it.first;
+// Narrow numeric elements are range checked in blocks: the raw values are
+// staged first and then checked in one branch-free pass.
+template <typename arg_t>
+constexpr bool isStagedElement() {
+    if constexpr (std::is_integral_v<arg_t>) {
+        return !std::is_same_v<arg_t, bool>
+            && !(std::is_signed_v<arg_t> && sizeof(arg_t) == sizeof(lua_Integer));
     }
-    if (maxIdx != vector.size()) {
-        *meta.errorStr = "wrong key sequence in table at arg ";
-        *meta.errorStr += std::to_string(meta.argIdx);
-        ok = false;
+    else {
+        return std::is_floating_point_v<arg_t> && sizeof(arg_t) < sizeof(lua_Number);
     }
-    if (!ok) {
-        meta.argIdx = INT32_MIN;
+}
+
+template <typename arg_t>
+struct StagedBlock {
+    using raw_t = std::conditional_t<std::is_integral_v<arg_t>, lua_Integer, lua_Number>;
+    static constexpr size_t capacity = 256;
+    raw_t values[capacity];
+    lua_Integer keys[capacity];
+    size_t size = 0;
+};
+
+template <typename arg_t, typename raw_t>
+bool rawFits(const raw_t raw) {
+    if constexpr (std::is_integral_v<arg_t>) {
+        return integerFits<arg_t>(raw);
     }
     else {
-        res = std::move(vector);
+        return numberFits<arg_t>(raw);
     }
-    return ok;
 }
 
-template <typename key_t, typename value_t, typename res_t>
-bool processMap(LuaCArgParseMeta& meta, res_t& res, const bool quietInit) {
-    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
-        if (!quietInit) {
-            *meta.errorStr = "a table expected at arg ";
-            *meta.errorStr += std::to_string(meta.argIdx);
-            meta.argIdx = INT32_MIN;
+// The range of every type is an interval, so the whole block is checked at
+// once by reductions without branches, which the compiler may vectorize for
+// the target (SSE2 lacks 64-bit lane compares), there is no explicit SIMD
+// path. The exact position is looked up only after a failure.
+template <typename arg_t, typename raw_t>
+size_t findOutOfRange(const raw_t* values, const size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    if constexpr (std::is_integral_v<arg_t>) {
+        raw_t min = values[0];
+        raw_t max = values[0];
+        for (size_t i = 1; i < size; ++i) {
+            min = values[i] < min ? values[i] : min;
+            max = values[i] > max ? values[i] : max;
+        }
+        if (rawFits<arg_t>(min) && rawFits<arg_t>(max)) {
+            return size;
+        }
+    }
+    else {
+        // NaN is not ordered, so the comparisons themselves are or-reduced.
+        constexpr raw_t lowest = std::numeric_limits<arg_t>::lowest();
+        constexpr raw_t highest = std::numeric_limits<arg_t>::max();
+        uint64_t outOfRange = 0;
+        for (size_t i = 0; i < size; ++i) {
+            outOfRange |= static_cast<uint64_t>((values[i] < lowest) | (values[i] > highest));
+        }
+        if (outOfRange == 0) {
+            return size;
+        }
+    }
+    size_t idx = 0;
+    while (rawFits<arg_t>(values[idx])) {
+        ++idx;
+    }
+    return idx;
+}
+
+// Stores the staged block, or reports its first value out of range exactly as
+// the element-wise parsing would do.
+template <typename arg_t, typename res_t>
+bool flushStagedBlock(LuaCArgParseMeta& meta, LuaCArgParseMeta& valueMeta,
+        StagedBlock<arg_t>& block, res_t& res) {
+    const size_t size = block.size;
+    block.size = 0;
+    const size_t failedIdx = findOutOfRange<arg_t>(block.values, size);
+    if (failedIdx == size) {
+        for (size_t i = 0; i < size; ++i) {
+            res[static_cast<size_t>(block.keys[i] - 1)] = static_cast<arg_t>(block.values[i]);
+        }
+        return true;
+    }
+    lua_pushinteger(meta.lua, block.keys[failedIdx]);
+    arg_t arg {};
+    // A type error of a later element may have left valueMeta aborted.
+    valueMeta.argIdx = -1;
+    if constexpr (std::is_integral_v<arg_t>) {
+        lua_pushinteger(meta.lua, block.values[failedIdx]);
+        processInteger<arg_t>(valueMeta, arg, false);
+    }
+    else {
+        lua_pushnumber(meta.lua, block.values[failedIdx]);
+        processFloat<arg_t>(valueMeta, arg, false);
+    }
+    pushErrorKey(meta, -2);
+    lua_pop(meta.lua, 2);
+    return false;
+}
+
+// Checks the key at -2 of a sequence of the given length.
+inline bool readSequenceKey(LuaCArgParseMeta& meta, const lua_Unsigned length,
+        lua_Integer& keyValue) {
+    if (!readInteger(meta.lua, -2, keyValue)) {
+        setError(meta, LuaCArgParseError::Code::IntegerKeyExpected, -2);
+        return false;
+    }
+    if (keyValue < 1) {
+        setError(meta, LuaCArgParseError::Code::NonPositiveKey, -2);
+        meta.error->isInteger = true;
+        meta.error->integer = keyValue;
+        return false;
+    }
+    if (static_cast<lua_Unsigned>(keyValue) > length) {
+        setError(meta, LuaCArgParseError::Code::WrongKeySequence, -2);
+        return false;
+    }
+    return true;
+}
+
+// Counts the entries of a table, stopping at the limit.
+inline lua_Unsigned countEntries(lua_State* lua, const int32_t tableIdx,
+        const lua_Unsigned limit) {
+    lua_Unsigned count = 0;
+    lua_pushnil(lua);
+    while (lua_next(lua, tableIdx) != 0) {
+        lua_pop(lua, 1);
+        if (++count == limit) {
+            lua_pop(lua, 1);
+            break;
         }
+    }
+    return count;
+}
+
+// The elements stored up front for a sequence, before its entries are seen.
+constexpr size_t sequenceReserve = 1024;
+
+// Finds room for the element of the key in the storage of a sequence, which
+// grows with the visited entries rather than being sized up front by the
+// border: a border n only tells that t[n] is not nil and t[n + 1] is, so 42
+// entries at 1, 2, 4, ..., 2^40 and 2^40 + 1 make a border of 2^40 + 1. The
+// storage starts with at most reserve elements, the keys of the array part
+// come in order and double it when they reach its end. A key further away has
+// the entries counted once, entries is 0 till then: as many of them as the
+// border give the storage in full, fewer mean holes, the element is then only
+// to be checked and false is returned. size is the number of elements stored,
+// updated to the one to resize to.
+inline bool findSequenceRoom(lua_State* lua, const int32_t tableIdx,
+        const lua_Unsigned length, const lua_Unsigned count, const lua_Integer keyValue,
+        const size_t reserve, lua_Unsigned& entries, size_t& size) {
+    const lua_Unsigned idx = static_cast<lua_Unsigned>(keyValue - 1);
+    if (idx < size) {
+        return true;
+    }
+    if (idx <= 2 * count) {
+        size = static_cast<size_t>(std::min(length, std::max({ idx + 1,
+            2 * static_cast<lua_Unsigned>(size), static_cast<lua_Unsigned>(reserve) })));
+        return true;
+    }
+    if (entries == 0) {
+        entries = countEntries(lua, tableIdx, length);
+    }
+    if (entries < length) {
         return false;
     }
+    size = static_cast<size_t>(length);
+    return true;
+}
+
+// An element of a vector (or of a column).
+template <typename arg_t>
+bool processElement(LuaCArgParseMeta& valueMeta, arg_t& arg) {
+    if constexpr (std::is_integral_v<arg_t>) {
+        return processInteger<arg_t>(valueMeta, arg, false);
+    }
+    else if constexpr (std::is_floating_point_v<arg_t>) {
+        return processFloat<arg_t>(valueMeta, arg, false);
+    }
+    else if constexpr (is_string<arg_t>::value) {
+        return processString<arg_t>(valueMeta, arg, false);
+    }
+    else if constexpr (is_variant<arg_t>::value) {
+        return processVariant(valueMeta, arg);
+    }
+    else if constexpr (is_optional<arg_t>::value) {
+        static_assert(always_false<arg_t>::value, "optional is not allowed in vector");
+    }
+    else if constexpr (is_tuple<arg_t>::value) {
+        static_assert(always_false<arg_t>::value, "tuple is not allowed in vector");
+    }
+    else {
+        static_assert(always_false<arg_t>::value, "prohibited combination");
+    }
+}
+
+// For a proper sequence the border is exactly the number of elements, so the
+// elements are filled by index. Any key outside of [1, length] means holes or
+// non-integer keys, i.e. a wrong sequence. The storage is either a pointer to
+// length elements or a vector grown with the visited entries, see
+// findSequenceRoom.
+template <typename storage_t>
+bool processSequence(LuaCArgParseMeta& meta, const int32_t tableIdx,
+        const lua_Unsigned length, storage_t& storage) {
+    using arg_t = std::remove_reference_t<decltype(storage[0])>;
+    lua_Unsigned count = 0;
+    lua_Unsigned entries = 0;
+    size_t size = 0;
+    if constexpr (!std::is_pointer_v<storage_t>) {
+        // The elements left from a previous parse are refilled in place.
+        if (storage.size() > length) {
+            storage.resize(static_cast<size_t>(length));
+        }
+        size = storage.size();
+    }
+    // An element of a sequence with holes is only checked.
+    std::optional<arg_t> spare;
     bool ok = true;
+    LuaCArgParseMeta valueMeta;
+    valueMeta.lua = meta.lua;
+    valueMeta.error = meta.error;
+    valueMeta.memoryResource = meta.memoryResource;
+    valueMeta.skipMissingFields = meta.skipMissingFields;
+    valueMeta.rejectExtraFields = meta.rejectExtraFields;
+    valueMeta.argIdx = -1;
+    // 4 KB of the stack, so only for the staged elements.
+    std::conditional_t<isStagedElement<arg_t>(), StagedBlock<arg_t>, std::monostate> block;
     lua_pushnil(meta.lua);
-    std::map<key_t, value_t> map;
-    bool quiet = quietInit;
-    while (lua_next(meta.lua, -2) != 0) {
+    while (lua_next(meta.lua, tableIdx) != 0) {
         if (!ok) {
             lua_pop(meta.lua, 1);
             continue;
         }
         do {
             // key at -2 and value at -1
-            LuaCArgParseMeta parseMeta;
-            parseMeta.lua = meta.lua;
-            parseMeta.errorStr = meta.errorStr;
-            parseMeta.argIdx = -2;
-            key_t key;
-            if constexpr (std::is_integral_v<key_t>) {
-                ok = processInteger<key_t>(parseMeta, key, quiet);
+            lua_Integer keyValue = 0;
+            ok = readSequenceKey(meta, length, keyValue);
+            if (!ok) {
+                break;
             }
-            else if constexpr (std::is_floating_point_v<key_t>) {
-                ok = processFloat<key_t>(parseMeta, key, quiet);
+            arg_t* arg = nullptr;
+            if constexpr (std::is_pointer_v<storage_t>) {
+                arg = storage + (keyValue - 1);
             }
-            else if constexpr (std::is_same_v<key_t, std::string>) {
-                ok = processString(parseMeta, key, quiet);
+            else if (findSequenceRoom(meta.lua, tableIdx, length, count, keyValue,
+                    sequenceReserve, entries, size)) {
+                if (size != storage.size()) {
+                    storage.resize(size);
+                }
+                arg = &storage[static_cast<size_t>(keyValue - 1)];
             }
             else {
-                static_assert(always_false<key_t>::value, "prohibited combination");
-            }
-            // If in variant && error && first iteration.
-            if (quietInit && !ok && map.empty()) {
-                // Revert.
-                lua_settable(meta.lua, -3);
-                return false;
-            }
-            if (ok) {
-                parseMeta.argIdx = -1;
-                value_t value;
-                if constexpr (std::is_integral_v<value_t>) {
-                    ok = processInteger<value_t>(parseMeta, value, quiet);
+                if (!spare) {
+                    spare.emplace();
                 }
-                else if constexpr (std::is_floating_point_v<value_t>) {
-                    ok = processFloat<value_t>(parseMeta, value, quiet);
+                arg = &*spare;
+            }
+            if constexpr (isStagedElement<arg_t>()) {
+                // A checked only element is not staged.
+                bool isRead = !spare || arg != &*spare;
+                if (isRead) {
+                    if constexpr (std::is_integral_v<arg_t>) {
+                        isRead = readInteger(meta.lua, -1, block.values[block.size]);
+                    }
+                    else {
+                        isRead = readNumber(meta.lua, -1, block.values[block.size]);
+                    }
                 }
-                else if constexpr (std::is_same_v<value_t, std::string>) {
-                    ok = processString(parseMeta, value, quiet);
+                if (!isRead) {
+                    // Reports the type error.
+                    if constexpr (std::is_integral_v<arg_t>) {
+                        ok = processInteger<arg_t>(valueMeta, *arg, false);
+                    }
+                    else {
+                        ok = processFloat<arg_t>(valueMeta, *arg, false);
+                    }
                 }
-                else if constexpr (is_vector<value_t>::value) {
-                    ok = processVector<typename value_t::value_type>(parseMeta, value, quiet);
+                else {
+                    block.keys[block.size] = keyValue;
+                    ++block.size;
+                    if (block.size == block.capacity) {
+                        ok = flushStagedBlock(meta, valueMeta, block, storage);
+                        if (!ok) {
+                            break;
+                        }
+                    }
                 }
-                else if constexpr (is_variant<value_t>::value) {
-                    ok = processVariant(parseMeta, value);
+            }
+            else {
+                ok = processElement(valueMeta, *arg);
+            }
+            if (ok) {
+                ++count;
+            }
+            else {
+                pushErrorKey(meta, -2);
+            }
+        } while (false);
+        if constexpr (isStagedElement<arg_t>()) {
+            if (!ok && block.size != 0) {
+                // A staged value out of range comes earlier than this error.
+                const LuaCArgParseError error = *meta.error;
+                meta.error->clear();
+                if (flushStagedBlock(meta, valueMeta, block, storage)) {
+                    *meta.error = error;
                 }
-                else if constexpr (is_optional<value_t>::value) {
-                    static_assert(always_false<value_t>::value, "optional is not allowed in map");
+            }
+        }
+        // Remove the value with keeping the key for the next iteration.
+        lua_pop(meta.lua, 1);
+    }
+    if constexpr (isStagedElement<arg_t>()) {
+        if (ok) {
+            ok = flushStagedBlock(meta, valueMeta, block, storage);
+        }
+    }
+    if (ok && count != length) {
+        // Keys are unique, so fewer of them than the border means holes.
+        setError(meta, LuaCArgParseError::Code::WrongKeySequence, meta.argIdx);
+        ok = false;
+    }
+    if (!ok) {
+        meta.argIdx = INT32_MIN;
+    }
+    return ok;
+}
+
+template <typename arg_t, typename res_t>
+bool processVector(LuaCArgParseMeta& meta, res_t& res) {
+    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
+        setError(meta, LuaCArgParseError::Code::TableExpected, meta.argIdx);
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    // The table is not necessarily on the top of the stack.
+    const int32_t tableIdx = lua_absindex(meta.lua, meta.argIdx);
+    // The elements are refilled in place, so a long-lived vector keeps its
+    // capacity and the capacity of its strings and nested vectors.
+    const lua_Unsigned length = lua_rawlen(meta.lua, tableIdx);
+    return processSequence(meta, tableIdx, length, res);
+}
+
+template <typename res_t>
+bool processMatrix(LuaCArgParseMeta& meta, res_t& res) {
+    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
+        setError(meta, LuaCArgParseError::Code::TableExpected, meta.argIdx);
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    // The table is not necessarily on the top of the stack.
+    const int32_t tableIdx = lua_absindex(meta.lua, meta.argIdx);
+    const lua_Unsigned rows = lua_rawlen(meta.lua, tableIdx);
+    res.rows = static_cast<size_t>(rows);
+    res.cols = 0;
+    res.data.clear();
+    // The columns are set by the first visited row, the buffer then grows with
+    // the visited rows and every row is parsed straight into its place.
+    bool hasCols = false;
+    size_t storedRows = 0;
+    lua_Unsigned entries = 0;
+    // A row of a matrix with holes is only checked.
+    std::vector<typename res_t::value_type> spareRow;
+    lua_Unsigned count = 0;
+    bool ok = true;
+    LuaCArgParseMeta rowMeta;
+    rowMeta.lua = meta.lua;
+    rowMeta.error = meta.error;
+    rowMeta.memoryResource = meta.memoryResource;
+    rowMeta.skipMissingFields = meta.skipMissingFields;
+    rowMeta.rejectExtraFields = meta.rejectExtraFields;
+    lua_pushnil(meta.lua);
+    while (lua_next(meta.lua, tableIdx) != 0) {
+        if (!ok) {
+            lua_pop(meta.lua, 1);
+            continue;
+        }
+        do {
+            // key at -2 and row at -1
+            lua_Integer keyValue = 0;
+            ok = readSequenceKey(meta, rows, keyValue);
+            if (!ok) {
+                break;
+            }
+            rowMeta.argIdx = -1;
+            if (lua_type(meta.lua, -1) != LUA_TTABLE) {
+                setError(rowMeta, LuaCArgParseError::Code::TableExpected, -1);
+                ok = false;
+                break;
+            }
+            const int32_t rowIdx = lua_absindex(meta.lua, -1);
+            const lua_Unsigned cols = lua_rawlen(meta.lua, rowIdx);
+            if (!hasCols) {
+                // The buffer is never sized by a border alone, the columns
+                // are counted once.
+                if (rows != 0 && cols > SIZE_MAX / rows) {
+                    setError(rowMeta, LuaCArgParseError::Code::WrongRowLength, -1);
+                    ok = false;
+                    break;
                 }
-                else if constexpr (is_tuple<value_t>::value) {
-                    static_assert(always_false<value_t>::value, "tuple is not allowed in map");
+                if (countEntries(meta.lua, rowIdx, cols) < cols) {
+                    setError(rowMeta, LuaCArgParseError::Code::WrongKeySequence, -1);
+                    ok = false;
+                    break;
                 }
-                else {
-                    static_assert(always_false<value_t>::value, "prohibited combination");
+                hasCols = true;
+                res.cols = static_cast<size_t>(cols);
+            }
+            if (cols != res.cols) {
+                setError(rowMeta, LuaCArgParseError::Code::WrongRowLength, -1);
+                ok = false;
+                break;
+            }
+            typename res_t::value_type* elements = res.data.data();
+            size_t size = storedRows;
+            if (res.cols == 0) {
+                // Nothing to store.
+            }
+            else if (findSequenceRoom(meta.lua, tableIdx, rows, count, keyValue,
+                    std::max<size_t>(sequenceReserve / res.cols, 1), entries, size)) {
+                if (size != storedRows) {
+                    storedRows = size;
+                    res.data.resize(storedRows * res.cols);
                 }
-                // If in variant && error && first iteration.
-                if (quietInit && !ok && map.empty()) {
-                    // Revert.
-                    lua_settable(meta.lua, -3);
-                    return false;
+                elements = res.data.data() + static_cast<size_t>(keyValue - 1) * res.cols;
+            }
+            else {
+                spareRow.resize(res.cols);
+                elements = spareRow.data();
+            }
+            ok = processSequence(rowMeta, rowIdx, cols, elements);
+        } while (false);
+        if (ok) {
+            ++count;
+        }
+        else {
+            pushErrorKey(meta, -2);
+        }
+        // Remove the row with keeping the key for the next iteration.
+        lua_pop(meta.lua, 1);
+    }
+    if (ok && count != rows) {
+        setError(meta, LuaCArgParseError::Code::WrongKeySequence, meta.argIdx);
+        ok = false;
+    }
+    if (!ok) {
+        meta.argIdx = INT32_MIN;
+    }
+    return ok;
+}
+
+// The keys of luaFields() are pushed as Lua strings once per Lua state and
+// kept in the registry, so a lookup does not hash the C strings again. Pushes
+// the table of the keys in the order of the fields.
+template <typename record_t>
+int32_t pushFieldKeys(lua_State* lua) {
+    // Its address is the registry key of record_t.
+    static char registryKey = 0;
+    if (lua_rawgetp(lua, LUA_REGISTRYINDEX, &registryKey) != LUA_TTABLE) {
+        lua_pop(lua, 1);
+        constexpr auto fields = record_t::luaFields();
+        lua_createtable(lua, static_cast<int32_t>(std::tuple_size_v<decltype(fields)>), 0);
+        lua_Integer keyNumber = 0;
+        std::apply([lua, &keyNumber](const auto& ...field) {
+            ((lua_pushstring(lua, field.name), lua_rawseti(lua, -2, ++keyNumber)), ...);
+        }, fields);
+        lua_pushvalue(lua, -1);
+        lua_rawsetp(lua, LUA_REGISTRYINDEX, &registryKey);
+    }
+    return lua_absindex(lua, -1);
+}
+
+// Pushes the value of the field keyNumber of the table at tableIdx.
+inline int32_t pushField(lua_State* lua, const int32_t tableIdx, const int32_t keysIdx,
+        const lua_Integer keyNumber) {
+    lua_rawgeti(lua, keysIdx, keyNumber);
+    return lua_rawget(lua, tableIdx);
+}
+
+inline void pushFieldErrorKey(LuaCArgParseMeta& meta, const int32_t keysIdx,
+        const lua_Integer keyNumber) {
+    lua_rawgeti(meta.lua, keysIdx, keyNumber);
+    pushErrorKey(meta, -1);
+    lua_pop(meta.lua, 1);
+}
+
+// Parses the field of the record at recordIdx into the element of its column.
+template <typename owner_t, typename member_t, typename record_t>
+bool processColumnField(LuaCArgParseMeta& meta, LuaCArgParseMeta& valueMeta,
+        const int32_t recordIdx, const int32_t keysIdx, const lua_Integer keyNumber,
+        const size_t elementIdx, const LuaCArgParseField<owner_t, member_t>& field,
+        record_t& res) {
+    static_assert(is_vector<member_t>::value, "every field of columns must be a vector");
+    pushField(meta.lua, recordIdx, keysIdx, keyNumber);
+    valueMeta.argIdx = -1;
+    const bool ok = processElement(valueMeta, (res.*field.member)[elementIdx]);
+    lua_pop(meta.lua, 1);
+    if (!ok) {
+        pushFieldErrorKey(meta, keysIdx, keyNumber);
+    }
+    return ok;
+}
+
+template <typename record_t>
+bool processColumns(LuaCArgParseMeta& meta, LuaCArgParseColumns<record_t>& res) {
+    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
+        setError(meta, LuaCArgParseError::Code::TableExpected, meta.argIdx);
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    // The table is not necessarily on the top of the stack.
+    const int32_t tableIdx = lua_absindex(meta.lua, meta.argIdx);
+    const lua_Unsigned length = lua_rawlen(meta.lua, tableIdx);
+    record_t& columns = res;
+    constexpr auto fields = record_t::luaFields();
+    // The columns grow together with the visited records, see
+    // findSequenceRoom, the elements left from a previous parse are refilled
+    // in place.
+    size_t size = 0;
+    const auto resizeColumns = [&columns, &size](const size_t newSize) {
+        std::apply([&columns, newSize](const auto& ...field) {
+            ((columns.*field.member).resize(newSize), ...);
+        }, record_t::luaFields());
+        size = newSize;
+    };
+    size = (columns.*std::get<0>(fields).member).size();
+    resizeColumns(static_cast<size_t>(std::min(static_cast<lua_Unsigned>(size), length)));
+    lua_Unsigned entries = 0;
+    // A record of columns with holes is only checked.
+    std::optional<record_t> spare;
+    const int32_t keysIdx = pushFieldKeys<record_t>(meta.lua);
+    lua_Unsigned count = 0;
+    bool ok = true;
+    LuaCArgParseMeta valueMeta;
+    valueMeta.lua = meta.lua;
+    valueMeta.error = meta.error;
+    valueMeta.memoryResource = meta.memoryResource;
+    valueMeta.skipMissingFields = meta.skipMissingFields;
+    valueMeta.rejectExtraFields = meta.rejectExtraFields;
+    lua_pushnil(meta.lua);
+    while (lua_next(meta.lua, tableIdx) != 0) {
+        if (!ok) {
+            lua_pop(meta.lua, 1);
+            continue;
+        }
+        do {
+            // key at -2 and record at -1
+            lua_Integer keyValue = 0;
+            ok = readSequenceKey(meta, length, keyValue);
+            if (!ok) {
+                break;
+            }
+            if (lua_type(meta.lua, -1) != LUA_TTABLE) {
+                valueMeta.argIdx = -1;
+                setError(valueMeta, LuaCArgParseError::Code::TableExpected, -1);
+                ok = false;
+            }
+            else {
+                // Only the known fields are looked up, one by one.
+                const int32_t recordIdx = lua_absindex(meta.lua, -1);
+                record_t* target = &columns;
+                size_t elementIdx = static_cast<size_t>(keyValue - 1);
+                size_t newSize = size;
+                if (findSequenceRoom(meta.lua, tableIdx, length, count, keyValue,
+                        sequenceReserve, entries, newSize)) {
+                    if (newSize != size) {
+                        resizeColumns(newSize);
+                    }
                 }
-                if (ok) {
-                    map[key] = std::move(value);
+                else {
+                    if (!spare) {
+                        spare.emplace();
+                        std::apply([&spare](const auto& ...field) {
+                            (((*spare).*field.member).resize(1), ...);
+                        }, fields);
+                    }
+                    target = &*spare;
+                    elementIdx = 0;
                 }
+                lua_Integer keyNumber = 0;
+                ok = std::apply([&](const auto& ...field) {
+                    return (processColumnField(meta, valueMeta, recordIdx, keysIdx,
+                        ++keyNumber, elementIdx, field, *target) && ...);
+                }, fields);
+            }
+            if (ok) {
+                ++count;
+            }
+            else {
+                pushErrorKey(meta, -2);
             }
-            quiet = false;
         } while (false);
-        // Remove the value with keeping the key for the next iteration.
+        // Remove the record with keeping the key for the next iteration.
+        lua_pop(meta.lua, 1);
+    }
+    // Remove the keys.
+    lua_pop(meta.lua, 1);
+    if (ok && count != length) {
+        setError(meta, LuaCArgParseError::Code::WrongKeySequence, meta.argIdx);
+        ok = false;
+    }
+    if (!ok) {
+        meta.argIdx = INT32_MIN;
+    }
+    return ok;
+}
+
+template <typename owner_t, typename member_t, typename record_t>
+bool processRecordField(LuaCArgParseMeta& meta, LuaCArgParseMeta& valueMeta,
+        const int32_t tableIdx, const int32_t keysIdx, const lua_Integer keyNumber,
+        const LuaCArgParseField<owner_t, member_t>& field, record_t& res,
+        int32_t& fieldsCount) {
+    member_t& member = res.*field.member;
+    valueMeta.argIdx = -1;
+    bool ok = true;
+    if (pushField(meta.lua, tableIdx, keysIdx, keyNumber) == LUA_TNIL) {
+        if constexpr (is_optional<member_t>::value) {
+            member.reset();
+        }
+        else if (!meta.skipMissingFields) {
+            // Reports the type error.
+            ok = processValue(valueMeta, member);
+        }
+    }
+    else {
+        ++fieldsCount;
+        if constexpr (is_optional<member_t>::value) {
+            using value_t = typename member_t::value_type;
+            if (!member.has_value() || !isReusable(meta, *member)) {
+                member.emplace(makeValue<value_t>(meta));
+            }
+            ok = processValue(valueMeta, *member);
+            if (!ok) {
+                member.reset();
+            }
+        }
+        else {
+            ok = processValue(valueMeta, member);
+        }
+    }
+    lua_pop(meta.lua, 1);
+    if (!ok) {
+        pushFieldErrorKey(meta, keysIdx, keyNumber);
+    }
+    return ok;
+}
+
+// Reports the first key of the table at tableIdx that is not a field.
+template <typename record_t>
+void setUnknownFieldError(LuaCArgParseMeta& meta, const int32_t tableIdx,
+        const int32_t keysIdx) {
+    constexpr lua_Integer fieldsNumber =
+        std::tuple_size_v<decltype(record_t::luaFields())>;
+    lua_pushnil(meta.lua);
+    while (lua_next(meta.lua, tableIdx) != 0) {
         lua_pop(meta.lua, 1);
+        bool isKnown = false;
+        for (lua_Integer keyNumber = 1; keyNumber <= fieldsNumber && !isKnown; ++keyNumber) {
+            lua_rawgeti(meta.lua, keysIdx, keyNumber);
+            isKnown = lua_rawequal(meta.lua, -1, -2) != 0;
+            lua_pop(meta.lua, 1);
+        }
+        if (!isKnown) {
+            setError(meta, LuaCArgParseError::Code::UnknownField, -1);
+            pushErrorKey(meta, -1);
+            lua_pop(meta.lua, 1);
+            return;
+        }
+    }
+}
+
+// Each field is fetched by its key, the table is not traversed unless the
+// extra fields are rejected.
+template <typename record_t>
+bool processRecord(LuaCArgParseMeta& meta, record_t& res) {
+    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
+        setError(meta, LuaCArgParseError::Code::TableExpected, meta.argIdx);
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    // The table is not necessarily on the top of the stack.
+    const int32_t tableIdx = lua_absindex(meta.lua, meta.argIdx);
+    const int32_t keysIdx = pushFieldKeys<record_t>(meta.lua);
+    LuaCArgParseMeta valueMeta;
+    valueMeta.lua = meta.lua;
+    valueMeta.error = meta.error;
+    valueMeta.memoryResource = meta.memoryResource;
+    valueMeta.skipMissingFields = meta.skipMissingFields;
+    valueMeta.rejectExtraFields = meta.rejectExtraFields;
+    int32_t fieldsCount = 0;
+    lua_Integer keyNumber = 0;
+    bool ok = std::apply([&](const auto& ...field) {
+        return (processRecordField(meta, valueMeta, tableIdx, keysIdx, ++keyNumber,
+            field, res, fieldsCount) && ...);
+    }, record_t::luaFields());
+    if (ok && meta.rejectExtraFields) {
+        int32_t entriesCount = 0;
+        lua_pushnil(meta.lua);
+        while (lua_next(meta.lua, tableIdx) != 0) {
+            lua_pop(meta.lua, 1);
+            ++entriesCount;
+        }
+        if (entriesCount != fieldsCount) {
+            setUnknownFieldError<record_t>(meta, tableIdx, keysIdx);
+            ok = false;
+        }
+    }
+    // Remove the keys.
+    lua_pop(meta.lua, 1);
+    if (!ok) {
+        meta.argIdx = INT32_MIN;
+    }
+    return ok;
+}
+
+// A value of a map or of a record field.
+template <typename value_t>
+bool processValue(LuaCArgParseMeta& valueMeta, value_t& value) {
+    if constexpr (std::is_integral_v<value_t>) {
+        return processInteger<value_t>(valueMeta, value, false);
+    }
+    else if constexpr (std::is_floating_point_v<value_t>) {
+        return processFloat<value_t>(valueMeta, value, false);
+    }
+    else if constexpr (is_string<value_t>::value) {
+        return processString<value_t>(valueMeta, value, false);
+    }
+    else if constexpr (is_vector<value_t>::value) {
+        return processVector<typename value_t::value_type>(valueMeta, value);
+    }
+    else if constexpr (is_map<value_t>::value) {
+        return processMap(valueMeta, value);
+    }
+    else if constexpr (is_matrix<value_t>::value) {
+        return processMatrix(valueMeta, value);
+    }
+    else if constexpr (is_columns<value_t>::value) {
+        return processColumns(valueMeta, value);
+    }
+    else if constexpr (is_record<value_t>::value) {
+        return processRecord(valueMeta, value);
+    }
+    else if constexpr (is_variant<value_t>::value) {
+        return processVariant(valueMeta, value);
+    }
+    else if constexpr (is_optional<value_t>::value) {
+        static_assert(always_false<value_t>::value, "optional is not allowed in map");
+    }
+    else if constexpr (is_tuple<value_t>::value) {
+        static_assert(always_false<value_t>::value,
+            "tuple is not allowed in map or record");
+    }
+    else {
+        static_assert(always_false<value_t>::value, "prohibited combination");
+    }
+}
+
+// Map keys are parsed into a scratch object before the lookup. The scratch of
+// an owning string is kept per thread, so it does not allocate once warmed up.
+// With a memory resource of the call a local key is used instead.
+template <typename key_t>
+key_t& scratchKey() {
+    static thread_local key_t key;
+    return key;
+}
+
+template <typename res_t>
+bool processMap(LuaCArgParseMeta& meta, res_t& res) {
+    using key_t = typename is_map<res_t>::key_type;
+    using value_t = typename is_map<res_t>::mapped_type;
+    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
+        setError(meta, LuaCArgParseError::Code::TableExpected, meta.argIdx);
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    // The table is not necessarily on the top of the stack.
+    const int32_t tableIdx = lua_absindex(meta.lua, meta.argIdx);
+    // The nodes of the previous contents of std::map are recycled: an entry
+    // takes the node of the same key if there was one, otherwise the node of a
+    // gone key. So a long-lived map refilled with the same keys keeps its nodes
+    // and the capacity of its values.
+    res_t spare(res.get_allocator());
+    // A flat map keeps its elements and refills them by position.
+    size_t size = 0;
+    if constexpr (is_unordered_map<res_t>::value) {
+        // The buckets are kept by clear() and reserved for the whole table.
+        size_t count = 0;
+        lua_pushnil(meta.lua);
+        while (lua_next(meta.lua, tableIdx) != 0) {
+            lua_pop(meta.lua, 1);
+            ++count;
+        }
+        res.clear();
+        res.reserve(count);
+    }
+    else if constexpr (!is_flat_map<res_t>::value) {
+        spare.swap(res);
+    }
+    bool ok = true;
+    lua_pushnil(meta.lua);
+    while (lua_next(meta.lua, tableIdx) != 0) {
+        if (!ok) {
+            lua_pop(meta.lua, 1);
+            continue;
+        }
+        do {
+            // key at -2 and value at -1
+            LuaCArgParseMeta parseMeta;
+            parseMeta.lua = meta.lua;
+            parseMeta.error = meta.error;
+            parseMeta.memoryResource = meta.memoryResource;
+            parseMeta.skipMissingFields = meta.skipMissingFields;
+            parseMeta.rejectExtraFields = meta.rejectExtraFields;
+            parseMeta.argIdx = -2;
+            key_t localKey = makeValue<key_t>(meta);
+            key_t* key = &localKey;
+            if constexpr (is_flat_map<res_t>::value) {
+                if (size == res.size()) {
+                    res.emplace_back();
+                }
+                key = &res[size].first;
+            }
+            else if constexpr (is_string<key_t>::value
+                    && !std::is_same_v<key_t, std::string_view>
+                    && !std::is_same_v<key_t, const char*>) {
+                if (!usesMemoryResource<key_t>() || meta.memoryResource == nullptr) {
+                    key = &scratchKey<key_t>();
+                }
+            }
+            if constexpr (std::is_integral_v<key_t>) {
+                ok = processInteger<key_t>(parseMeta, *key, false);
+            }
+            else if constexpr (std::is_floating_point_v<key_t>) {
+                ok = processFloat<key_t>(parseMeta, *key, false);
+            }
+            else if constexpr (is_string<key_t>::value) {
+                ok = processString<key_t>(parseMeta, *key, false);
+            }
+            else {
+                static_assert(always_false<key_t>::value, "prohibited combination");
+            }
+            if (!ok) {
+                break;
+            }
+            value_t* value = nullptr;
+            // The value left by another key. The skipped fields of its records
+            // would keep the values of that key, so it is reset then.
+            bool isForeign = false;
+            if constexpr (is_flat_map<res_t>::value) {
+                value = &res[size].second;
+                isForeign = true;
+            }
+            else if constexpr (is_unordered_map<res_t>::value) {
+                value = &res.try_emplace(*key).first->second;
+            }
+            else {
+                typename res_t::node_type node;
+                // Views left from a previous call may dangle, never compare them.
+                if constexpr (!std::is_same_v<key_t, std::string_view>
+                        && !std::is_same_v<key_t, const char*>) {
+                    node = spare.extract(*key);
+                }
+                if (node.empty() && !spare.empty()) {
+                    node = spare.extract(spare.begin());
+                    node.key() = *key;
+                    isForeign = true;
+                }
+                value = node.empty()
+                    ? &res.try_emplace(*key).first->second
+                    : &res.insert(std::move(node)).position->second;
+            }
+            if (isForeign && meta.skipMissingFields) {
+                *value = makeValue<value_t>(meta);
+            }
+            parseMeta.argIdx = -1;
+            ok = processValue(parseMeta, *value);
+            if (!ok) {
+                pushErrorKey(meta, -2);
+                break;
+            }
+            ++size;
+        } while (false);
+        // Remove the value with keeping the key for the next iteration.
+        lua_pop(meta.lua, 1);
+    }
+    if (!ok) {
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    if constexpr (is_flat_map<res_t>::value) {
+        // Sorted once after appending. Only the keys narrowed to the same
+        // value may repeat, one of them is kept.
+        res.resize(size);
+        const auto less = [](const auto& left, const auto& right) {
+            return std::less<key_t>()(left.first, right.first);
+        };
+        std::sort(res.begin(), res.end(), less);
+        res.erase(std::unique(res.begin(), res.end(),
+            [&less](const auto& left, const auto& right) {
+                return !less(left, right) && !less(right, left);
+            }), res.end());
+    }
+    return true;
+}
+
+// A view only remembers where its table is, the table stays on the stack.
+template <typename view_t>
+bool bindView(LuaCArgParseMeta& meta, view_t& view) {
+    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
+        setError(meta, LuaCArgParseError::Code::TableExpected, meta.argIdx);
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    view.lua = meta.lua;
+    view.tableIdx = lua_absindex(meta.lua, meta.argIdx);
+    view.argIdx = meta.argIdx;
+    view.cache.clear();
+    return true;
+}
+
+template <typename T>
+bool processView(LuaCArgParseMeta& meta, LuaCArgParseArrayView<T>& view) {
+    if (!bindView(meta, view)) {
+        return false;
+    }
+    view.length = static_cast<size_t>(lua_rawlen(meta.lua, view.tableIdx));
+    return true;
+}
+
+template <typename key_t, typename value_t>
+bool processView(LuaCArgParseMeta& meta, LuaCArgParseMapView<key_t, value_t>& view) {
+    return bindView(meta, view);
+}
+
+// Converts the value on the top of the stack for a view, its key is at -2.
+template <typename value_t>
+bool processViewValue(lua_State* lua, const int32_t argIdx, value_t& value,
+        LuaCArgParseError& error) {
+    LuaCArgParseMeta meta;
+    meta.lua = lua;
+    meta.error = &error;
+    meta.argIdx = -1;
+    if (processValue(meta, value)) {
+        return true;
+    }
+    meta.argIdx = argIdx;
+    pushErrorKey(meta, -2);
+    return false;
+}
+
+// Converts the elements 1..#t one by one into the same temporary, which is
+// passed to the callback while the element is still on the stack.
+template <typename T, typename callback_t>
+LuaCArgForEachResult processForEach(LuaCArgParseMeta& meta, callback_t& callback) {
+    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
+        setError(meta, LuaCArgParseError::Code::TableExpected, meta.argIdx);
+        return LuaCArgForEachResult::Failed;
+    }
+    const int32_t tableIdx = lua_absindex(meta.lua, meta.argIdx);
+    const lua_Unsigned length = lua_rawlen(meta.lua, tableIdx);
+    LuaCArgParseMeta valueMeta;
+    valueMeta.lua = meta.lua;
+    valueMeta.error = meta.error;
+    valueMeta.memoryResource = meta.memoryResource;
+    valueMeta.argIdx = -1;
+    T element {};
+    for (lua_Unsigned i = 1; i <= length; ++i) {
+        lua_rawgeti(meta.lua, tableIdx, static_cast<lua_Integer>(i));
+        if (!processElement(valueMeta, element)) {
+            lua_pushinteger(meta.lua, static_cast<lua_Integer>(i));
+            pushErrorKey(meta, -1);
+            lua_pop(meta.lua, 2);
+            return LuaCArgForEachResult::Failed;
+        }
+        const bool isContinued = callback(static_cast<const T&>(element));
+        lua_pop(meta.lua, 1);
+        if (!isContinued) {
+            return LuaCArgForEachResult::Stopped;
+        }
+    }
+    return LuaCArgForEachResult::Completed;
+}
+
+struct VariantVisitor {
+    LuaCArgParseMeta* meta = nullptr;
+    bool success = false;
+    // The error of the first container alternative that failed in full.
+    std::optional<LuaCArgParseError> firstError;
+
+    // A container alternative passed its probe, but its full parse may still
+    // fail on a later entry, e.g. { 1, 1000 } for std::vector<int8_t>. Then
+    // the next candidate is tried from the same argument. The probe of the
+    // first entry is a heuristic fast path, not a classification of the
+    // whole table: a table fitting several alternatives up to a late entry
+    // is parsed once per such alternative.
+    bool settle(const int32_t argIdx) {
+        if (success) {
+            return true;
+        }
+        if (!firstError.has_value()) {
+            firstError = *meta->error;
+        }
+        meta->error->clear();
+        meta->argIdx = argIdx;
+        return false;
+    }
+
+    template <typename arg_t, typename ...args_t>
+    bool operator()(std::variant<args_t...>& arg) {
+        using T = arg_t;
+#ifdef _DEBUG
+        const auto lua_type_test = lua_typename(meta->lua, lua_type(meta->lua, meta->argIdx));
+        (void)lua_type_test;
+#endif // _DEBUG
+        if constexpr (std::is_integral_v<T>) {
+            success = processInteger<T>(*meta, arg, true);
+        }
+        else if constexpr (std::is_floating_point_v<T>) {
+            success = processFloat<T>(*meta, arg, true);
+        }
+        else if constexpr (is_string<T>::value) {
+            success = processString<T>(*meta, arg, true);
+        }
+        else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+            return false;
+        }
+        else if constexpr (is_vector<T>::value) {
+            if (!probeValue<T>(meta->lua, meta->argIdx)) {
+                return false;
+            }
+            if (!std::holds_alternative<T>(arg) || !isReusable(*meta, std::get<T>(arg))) {
+                arg.template emplace<T>(makeValue<T>(*meta));
+            }
+            const int32_t argIdx = meta->argIdx;
+            success = processVector<typename T::value_type>(*meta, std::get<T>(arg));
+            return settle(argIdx);
+        }
+        else if constexpr (is_map<T>::value) {
+            if (!probeValue<T>(meta->lua, meta->argIdx)) {
+                return false;
+            }
+            if (!std::holds_alternative<T>(arg) || !isReusable(*meta, std::get<T>(arg))) {
+                arg.template emplace<T>(makeValue<T>(*meta));
+            }
+            const int32_t argIdx = meta->argIdx;
+            success = processMap(*meta, std::get<T>(arg));
+            return settle(argIdx);
+        }
+        else if constexpr (is_matrix<T>::value) {
+            if (!probeValue<T>(meta->lua, meta->argIdx)) {
+                return false;
+            }
+            if (!std::holds_alternative<T>(arg) || !isReusable(*meta, std::get<T>(arg))) {
+                arg.template emplace<T>(makeValue<T>(*meta));
+            }
+            const int32_t argIdx = meta->argIdx;
+            success = processMatrix(*meta, std::get<T>(arg));
+            return settle(argIdx);
+        }
+        else if constexpr (is_columns<T>::value) {
+            if (!probeValue<T>(meta->lua, meta->argIdx)) {
+                return false;
+            }
+            if (!std::holds_alternative<T>(arg)) {
+                arg.template emplace<T>();
+            }
+            const int32_t argIdx = meta->argIdx;
+            success = processColumns(*meta, std::get<T>(arg));
+            return settle(argIdx);
+        }
+        else if constexpr (is_record<T>::value) {
+            if (!probeValue<T>(meta->lua, meta->argIdx)) {
+                return false;
+            }
+            if (!std::holds_alternative<T>(arg)) {
+                arg.template emplace<T>();
+            }
+            const int32_t argIdx = meta->argIdx;
+            success = processRecord(*meta, std::get<T>(arg));
+            return settle(argIdx);
+        }
+        else if constexpr (is_optional<T>::value) {
+            static_assert(always_false<T>::value, "optional is not allowed in variant");
+        }
+        else if constexpr (is_variant<T>::value) {
+            static_assert(always_false<T>::value, "variant is not allowed in variant");
+        }
+        else if constexpr (is_tuple<T>::value) {
+            static_assert(always_false<T>::value, "tuple is not allowed in variant");
+        }
+        else {
+            static_assert(always_false<T>::value, "prohibited combination");
+        }
+        return success;
+    }
+};
+
+struct TupleVisitor {
+    LuaCArgParseMeta* meta = nullptr;
+    bool isOnlyOptionalAllowed = false;
+
+    template<typename arg_t>
+    bool operator()(arg_t&& arg) {
+        using T = std::decay_t<decltype(arg)>;
+        ++meta->argIdx;
+#ifdef _DEBUG
+        const auto lua_type_test = lua_typename(meta->lua, lua_type(meta->lua, meta->argIdx));
+        (void)lua_type_test;
+#endif // _DEBUG
+        if (isOnlyOptionalAllowed) {
+            if constexpr (!is_optional<T>::value) {
+                setError(*meta, LuaCArgParseError::Code::OptionalMustBeLast, meta->argIdx);
+                meta->argIdx = INT32_MIN;
+                return false;
+            }
+        }
+        if constexpr (std::is_integral_v<T>) {
+            return processInteger<T>(*meta, arg, false);
+        }
+        else if constexpr (std::is_floating_point_v<T>) {
+            return processFloat<T>(*meta, arg, false);
+        }
+        else if constexpr (is_string<T>::value) {
+            return processString<T>(*meta, arg, false);
+        }
+        else if constexpr (is_variant<T>::value) {
+            return processVariant(*meta, arg);
+        }
+        else if constexpr (is_optional<T>::value) {
+            isOnlyOptionalAllowed = true;
+            return processOptional(*meta, arg);
+        }
+        else if constexpr (is_vector<T>::value) {
+            return processVector<typename T::value_type>(*meta, arg);
+        }
+        else if constexpr (is_map<T>::value) {
+            return processMap(*meta, arg);
+        }
+        else if constexpr (is_matrix<T>::value) {
+            return processMatrix(*meta, arg);
+        }
+        else if constexpr (is_columns<T>::value) {
+            return processColumns(*meta, arg);
+        }
+        else if constexpr (is_record<T>::value) {
+            return processRecord(*meta, arg);
+        }
+        else if constexpr (is_view<T>::value) {
+            return processView(*meta, arg);
+        }
+        else {
+            static_assert(always_false<T>::value, "prohibited combination");
+        }
+    }
+};
+
+template <typename ...args_t>
+bool processVariant(LuaCArgParseMeta& meta, std::variant<args_t...>& variant) {
+    static constexpr auto candidates = variantCandidates<args_t...>();
+    const LuaTag tag = luaTag(meta.lua, meta.argIdx);
+    if (tag == LuaTag::None) {
+        setError(meta, LuaCArgParseError::Code::WrongArgumentsNumber, meta.argIdx);
+        return false;
+    }
+    VariantVisitor visitor;
+    visitor.meta = &meta;
+    // Only the alternatives that can match the Lua type are tried, still in
+    // the declaration order.
+    foreach_(visitor, variant, candidates[static_cast<size_t>(tag)]);
+    if (visitor.success) {
+        return true;
+    }
+    if (visitor.firstError.has_value()) {
+        // None of the containers fit, the first one tells why.
+        *meta.error = *visitor.firstError;
+        meta.argIdx = INT32_MIN;
+    }
+    else if (meta.error->empty()) {
+        setError(meta, LuaCArgParseError::Code::NoSuitableVariant, meta.argIdx);
+    }
+    return false;
+}
+
+// The error that parsing an argument of type T reports for a value of a
+// Lua type that T does not accept.
+template <typename T>
+constexpr LuaCArgParseError::Code typeErrorCode(const LuaTag tag) {
+    if constexpr (std::is_integral_v<T>) {
+        return LuaCArgParseError::Code::IntegerExpected;
+    }
+    else if constexpr (std::is_floating_point_v<T>) {
+        return LuaCArgParseError::Code::NumberExpected;
+    }
+    else if constexpr (is_string<T>::value) {
+        return LuaCArgParseError::Code::StringExpected;
+    }
+    else if constexpr (is_optional<T>::value) {
+        return typeErrorCode<typename T::value_type>(tag);
+    }
+    else if constexpr (is_variant<T>::value) {
+        return tag == LuaTag::None ? LuaCArgParseError::Code::WrongArgumentsNumber
+            : LuaCArgParseError::Code::NoSuitableVariant;
+    }
+    else {
+        return LuaCArgParseError::Code::TableExpected;
+    }
+}
+
+// The tags of the arguments 1..count, the missing ones are LuaTag::None.
+inline void readArgumentTags(lua_State* lua, const int32_t count, LuaTag* tags) {
+    for (int32_t idx = 1; idx <= count; ++idx) {
+        tags[idx - 1] = luaTag(lua, idx);
+    }
+}
+
+// Matches the tags of the arguments against a signature. Returns 0 on success,
+// the index of the first argument of a wrong type, or count + 1 if there are
+// too many arguments.
+template <typename ...args_t>
+constexpr int32_t findWrongArgument(const LuaTag* tags, const int32_t argsNumber,
+        std::tuple<args_t...>*) {
+    constexpr int32_t count = static_cast<int32_t>(sizeof...(args_t));
+    // With an extra element so that the arrays are never empty.
+    constexpr uint32_t accepted[] = { acceptedLuaTags<args_t>()..., 0 };
+    constexpr bool isOptional[] = { is_optional<args_t>::value..., false };
+    // A misplaced optional is a wrong signature, the parsing reports it.
+    int32_t checked = 0;
+    while (checked < count
+            && !(checked > 0 && isOptional[checked - 1] && !isOptional[checked])) {
+        ++checked;
+    }
+    for (int32_t idx = 1; idx <= checked; ++idx) {
+        if ((luaTagBit(tags[idx - 1]) & accepted[idx - 1]) == 0) {
+            return idx;
+        }
+    }
+    if (checked == count && argsNumber > count) {
+        return count + 1;
+    }
+    return 0;
+}
+
+// The arity and the Lua types of all the arguments are checked against the
+// signature before anything is built, so a wrong call does not parse (and
+// allocate) the arguments that precede the wrong one. The errors are the same
+// as the parsing itself reports, the values are checked later.
+template <typename ...args_t>
+bool checkArgumentTypes(LuaCArgParseMeta& meta, std::tuple<args_t...>* tuple) {
+    constexpr int32_t count = static_cast<int32_t>(sizeof...(args_t));
+    LuaTag tags[count + 1] = {};
+    // Only the arguments, the stack may hold more values above them.
+    readArgumentTags(meta.lua, std::min(count, meta.argsNumber), tags);
+    const int32_t wrongIdx = findWrongArgument(tags, meta.argsNumber, tuple);
+    if (wrongIdx == 0) {
+        return true;
+    }
+    if (wrongIdx > count) {
+        meta.error->code = LuaCArgParseError::Code::WrongArgumentsNumber;
+        return false;
+    }
+    constexpr LuaCArgParseError::Code (*errorCodes[])(LuaTag) = {
+        typeErrorCode<args_t>..., typeErrorCode<std::nullptr_t> };
+    meta.argIdx = wrongIdx;
+    setError(meta, errorCodes[wrongIdx - 1](tags[wrongIdx - 1]), wrongIdx);
+    return false;
+}
+
+template <typename ...args_t>
+bool processTuple(LuaCArgParseMeta& meta, std::tuple<args_t...>& tuple) {
+    if (!checkArgumentTypes(meta, &tuple)) {
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    return processTupleArguments(meta, tuple);
+}
+
+// Parses the arguments into the tuple, their types are already checked.
+template <typename ...args_t>
+bool processTupleArguments(LuaCArgParseMeta& meta, std::tuple<args_t...>& tuple) {
+    TupleVisitor visitor;
+    visitor.meta = &meta;
+    foreach_(visitor, tuple);
+    return meta.argIdx == meta.argsNumber && meta.error->empty();
+}
+
+// Converts at most budget elements of the vector argument meta.argIdx,
+// continuing from the cursor. The traversal is the one of processSequence,
+// so the result and the errors are the same.
+template <typename res_t>
+bool processVectorChunk(LuaCArgParseMeta& meta, res_t& res, LuaCArgParseCursor& cursor,
+        lua_Unsigned& budget) {
+    if (!cursor.isInTable) {
+        if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
+            setError(meta, LuaCArgParseError::Code::TableExpected, meta.argIdx);
+            meta.argIdx = INT32_MIN;
+            return false;
+        }
+        cursor.length = lua_rawlen(meta.lua, meta.argIdx);
+        if (res.size() > cursor.length) {
+            res.resize(static_cast<size_t>(cursor.length));
+        }
+        cursor.count = 0;
+        cursor.entries = 0;
+        cursor.isInTable = true;
+        lua_pushnil(meta.lua);
+    }
+    const lua_Unsigned length = cursor.length;
+    // An element of a vector with holes is only checked.
+    std::optional<typename res_t::value_type> spare;
+    LuaCArgParseMeta valueMeta;
+    valueMeta.lua = meta.lua;
+    valueMeta.error = meta.error;
+    valueMeta.memoryResource = meta.memoryResource;
+    valueMeta.argIdx = -1;
+    for (; budget != 0; --budget) {
+        if (lua_next(meta.lua, meta.argIdx) == 0) {
+            cursor.isInTable = false;
+            if (cursor.count != length) {
+                setError(meta, LuaCArgParseError::Code::WrongKeySequence, meta.argIdx);
+                meta.argIdx = INT32_MIN;
+                return false;
+            }
+            return true;
+        }
+        // key at -2 and value at -1
+        lua_Integer keyValue = 0;
+        bool ok = readSequenceKey(meta, length, keyValue);
+        if (ok) {
+            size_t size = res.size();
+            typename res_t::value_type* arg = nullptr;
+            if (findSequenceRoom(meta.lua, meta.argIdx, length, cursor.count, keyValue,
+                    sequenceReserve, cursor.entries, size)) {
+                if (size != res.size()) {
+                    res.resize(size);
+                }
+                arg = &res[static_cast<size_t>(keyValue - 1)];
+            }
+            else {
+                if (!spare) {
+                    spare.emplace();
+                }
+                arg = &*spare;
+            }
+            ok = processElement(valueMeta, *arg);
+            if (!ok) {
+                pushErrorKey(meta, -2);
+            }
+        }
+        if (!ok) {
+            lua_pop(meta.lua, 2);
+            cursor.isInTable = false;
+            meta.argIdx = INT32_MIN;
+            return false;
+        }
+        ++cursor.count;
+        lua_pop(meta.lua, 1);
+    }
+    return true;
+}
+
+// Parses the arguments from the cursor on like TupleVisitor, the vector
+// arguments are converted in chunks.
+struct ChunkVisitor {
+    TupleVisitor visitor;
+    LuaCArgParseCursor* cursor = nullptr;
+    lua_Unsigned budget = 0;
+
+    template<typename arg_t>
+    bool operator()(arg_t&& arg) {
+        using T = std::decay_t<decltype(arg)>;
+        LuaCArgParseMeta& meta = *visitor.meta;
+        if (meta.argIdx + 1 < cursor->argIdx) {
+            // Parsed by a previous chunk.
+            ++meta.argIdx;
+            visitor.isOnlyOptionalAllowed = visitor.isOnlyOptionalAllowed
+                || is_optional<T>::value;
+            return true;
+        }
+        if (budget == 0) {
+            return false;
+        }
+        if constexpr (is_vector<T>::value) {
+            if (!visitor.isOnlyOptionalAllowed) {
+                ++meta.argIdx;
+                if (!processVectorChunk(meta, arg, *cursor, budget)) {
+                    return false;
+                }
+                if (cursor->isInTable) {
+                    // Out of budget.
+                    return false;
+                }
+                ++cursor->argIdx;
+                return true;
+            }
+        }
+        if (!visitor(arg)) {
+            return false;
+        }
+        ++cursor->argIdx;
+        return true;
+    }
+};
+
+// Parses the next chunk of the arguments: the arguments are checked up front
+// and then converted one by one, at most budget elements of the vector
+// arguments per chunk. Returns true when the parse is over, successful or not.
+template <typename ...args_t>
+bool processTupleChunk(LuaCArgParseMeta& meta, std::tuple<args_t...>& tuple,
+        LuaCArgParseCursor& cursor, const lua_Unsigned budget, bool& ok) {
+    if (cursor.argIdx == 1 && !cursor.isInTable && !checkArgumentTypes(meta, &tuple)) {
+        ok = false;
+        return true;
+    }
+    ChunkVisitor chunkVisitor;
+    chunkVisitor.visitor.meta = &meta;
+    chunkVisitor.cursor = &cursor;
+    chunkVisitor.budget = budget;
+    meta.argIdx = 0;
+    foreach_(chunkVisitor, tuple);
+    if (meta.error->empty() && cursor.argIdx <= static_cast<int32_t>(sizeof...(args_t))) {
+        return false;
+    }
+    ok = meta.error->empty();
+    if (ok && meta.argIdx != meta.argsNumber) {
+        meta.error->code = LuaCArgParseError::Code::WrongArgumentsNumber;
+        ok = false;
+    }
+    return true;
+}
+
+struct OverloadVisitor {
+    LuaCArgParseMeta* meta = nullptr;
+    bool success = false;
+
+    template <typename tuple_t, typename ...tuples_t>
+    bool operator()(std::variant<tuples_t...>& overloads) {
+        if (!std::holds_alternative<tuple_t>(overloads)) {
+            overloads.template emplace<tuple_t>();
+        }
+        success = processTupleArguments(*meta, std::get<tuple_t>(overloads));
+        // The signature is chosen, any error is final.
+        return true;
+    }
+};
+
+template <typename ...tuples_t, size_t ...altIdx>
+uint64_t matchingSignatures(const LuaTag* tags, const int32_t argsNumber,
+        std::index_sequence<altIdx...>) {
+    static_assert(sizeof...(tuples_t) <= 64, "too many signatures");
+    return ((findWrongArgument(tags, argsNumber, static_cast<tuples_t*>(nullptr)) == 0
+        ? uint64_t(1) << altIdx : 0) | ...);
+}
+
+// Each tuple is a signature. The arguments' tags are read once and matched
+// against the constexpr tables of every signature, then the first matching
+// signature in the declaration order is parsed.
+template <typename ...tuples_t>
+bool processOverloads(LuaCArgParseMeta& meta, std::variant<tuples_t...>& overloads) {
+    constexpr int32_t count = std::max({ static_cast<int32_t>(std::tuple_size_v<tuples_t>)... });
+    LuaTag tags[count + 1] = {};
+    // Only the arguments, the stack may hold more values above them.
+    readArgumentTags(meta.lua, std::min(count, meta.argsNumber), tags);
+    const uint64_t candidates = matchingSignatures<tuples_t...>(tags, meta.argsNumber,
+        std::index_sequence_for<tuples_t...>());
+    if (candidates == 0) {
+        setError(meta, LuaCArgParseError::Code::NoMatchingSignature, 1);
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    OverloadVisitor visitor;
+    visitor.meta = &meta;
+    foreach_(visitor, overloads, candidates & (~candidates + 1));
+    return visitor.success;
+}
+
+// Pushes the text of the error, formatted straight into a Lua buffer.
+inline void pushErrorMessage(lua_State* lua, const LuaCArgParseError& error) {
+    luaL_Buffer buffer;
+    luaL_buffinit(lua, &buffer);
+    error.format([&buffer](const char* piece, const size_t len) {
+        luaL_addlstring(&buffer, piece, len);
+    });
+    luaL_pushresult(&buffer);
+}
+
+// Raises the error like luaL_argerror does for a bad argument and like
+// luaL_error otherwise. The text is built right in a Lua buffer.
+inline int32_t raiseError(lua_State* lua, const LuaCArgParseError& error) {
+    using Code = LuaCArgParseError::Code;
+    const int32_t argIdx = error.depth > 0 ? error.rootArgIdx : error.argIdx;
+    const bool isBadArgument = argIdx > 0 && error.code != Code::WrongArgumentsNumber
+        && error.code != Code::OptionalMustBeLast && error.code != Code::NoMatchingSignature;
+    pushErrorMessage(lua, error);
+    if (isBadArgument) {
+        // The message is anchored on the stack.
+        return luaL_argerror(lua, argIdx, lua_tostring(lua, -1));
+    }
+    luaL_where(lua, 1);
+    lua_insert(lua, -2);
+    lua_concat(lua, 2);
+    return lua_error(lua);
+}
+
+template <typename T>
+void pushValue(lua_State* lua, const T& value);
+
+// A table of the known fields of a record, nil fields are left out.
+template <typename record_t>
+void pushRecord(lua_State* lua, const record_t& record) {
+    constexpr auto fields = record_t::luaFields();
+    constexpr int32_t fieldsNumber = static_cast<int32_t>(std::tuple_size_v<decltype(fields)>);
+    const int32_t keysIdx = pushFieldKeys<record_t>(lua);
+    lua_createtable(lua, 0, fieldsNumber);
+    lua_Integer keyNumber = 0;
+    std::apply([lua, &record, keysIdx, &keyNumber](const auto& ...field) {
+        ((lua_rawgeti(lua, keysIdx, ++keyNumber), pushValue(lua, record.*field.member),
+            lua_rawset(lua, -3)), ...);
+    }, fields);
+    // Remove the keys.
+    lua_remove(lua, keysIdx);
+}
+
+// Tables are created with the exact sizes of their array and hash parts.
+template <typename T>
+void pushValue(lua_State* lua, const T& value) {
+    if constexpr (std::is_same_v<T, bool>) {
+        lua_pushboolean(lua, value ? 1 : 0);
+    }
+    else if constexpr (std::is_integral_v<T>) {
+        lua_pushinteger(lua, static_cast<lua_Integer>(value));
+    }
+    else if constexpr (std::is_floating_point_v<T>) {
+        lua_pushnumber(lua, static_cast<lua_Number>(value));
+    }
+    else if constexpr (std::is_same_v<T, const char*> || std::is_same_v<T, char*>) {
+        lua_pushstring(lua, value);
+    }
+    else if constexpr (is_string<T>::value) {
+        lua_pushlstring(lua, value.data(), value.size());
+    }
+    else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+        lua_pushnil(lua);
+    }
+    else if constexpr (is_optional<T>::value) {
+        if (value.has_value()) {
+            pushValue(lua, *value);
+        }
+        else {
+            lua_pushnil(lua);
+        }
+    }
+    else if constexpr (is_variant<T>::value) {
+        if (value.valueless_by_exception()) {
+            lua_pushnil(lua);
+            return;
+        }
+        std::visit([lua](const auto& alternative) {
+            pushValue(lua, alternative);
+        }, value);
+    }
+    else if constexpr (is_vector<T>::value) {
+        luaL_checkstack(lua, 2, nullptr);
+        lua_createtable(lua, static_cast<int32_t>(value.size()), 0);
+        lua_Integer keyValue = 0;
+        for (const auto& element : value) {
+            pushValue(lua, element);
+            lua_rawseti(lua, -2, ++keyValue);
+        }
+    }
+    else if constexpr (is_map<T>::value) {
+        luaL_checkstack(lua, 3, nullptr);
+        lua_createtable(lua, 0, static_cast<int32_t>(value.size()));
+        for (const auto& [key, element] : value) {
+            pushValue(lua, key);
+            pushValue(lua, element);
+            lua_rawset(lua, -3);
+        }
+    }
+    else if constexpr (is_matrix<T>::value) {
+        luaL_checkstack(lua, 3, nullptr);
+        lua_createtable(lua, static_cast<int32_t>(value.rows), 0);
+        for (size_t row = 0; row < value.rows; ++row) {
+            lua_createtable(lua, static_cast<int32_t>(value.cols), 0);
+            for (size_t col = 0; col < value.cols; ++col) {
+                pushValue(lua, value(row, col));
+                lua_rawseti(lua, -2, static_cast<lua_Integer>(col + 1));
+            }
+            lua_rawseti(lua, -2, static_cast<lua_Integer>(row + 1));
+        }
+    }
+    else if constexpr (is_columns<T>::value) {
+        // An array of records, as long as the first column.
+        using record_t = typename T::record_type;
+        constexpr auto fields = record_t::luaFields();
+        constexpr int32_t fieldsNumber =
+            static_cast<int32_t>(std::tuple_size_v<decltype(fields)>);
+        const record_t& columns = value;
+        const size_t length = (columns.*std::get<0>(fields).member).size();
+        luaL_checkstack(lua, 5, nullptr);
+        const int32_t keysIdx = pushFieldKeys<record_t>(lua);
+        lua_createtable(lua, static_cast<int32_t>(length), 0);
+        for (size_t row = 0; row < length; ++row) {
+            lua_createtable(lua, 0, fieldsNumber);
+            lua_Integer keyNumber = 0;
+            std::apply([lua, &columns, row, keysIdx, &keyNumber](const auto& ...field) {
+                ((lua_rawgeti(lua, keysIdx, ++keyNumber),
+                    pushValue(lua, (columns.*field.member)[row]), lua_rawset(lua, -3)), ...);
+            }, fields);
+            lua_rawseti(lua, -2, static_cast<lua_Integer>(row + 1));
+        }
+        // Remove the keys.
+        lua_remove(lua, keysIdx);
+    }
+    else if constexpr (is_record<T>::value) {
+        luaL_checkstack(lua, 4, nullptr);
+        pushRecord(lua, value);
+    }
+    else {
+        static_assert(always_false<T>::value, "prohibited combination");
+    }
+}
+
+// The elements of a tuple are pushed as multiple values.
+template <typename T>
+int32_t pushResults(lua_State* lua, const T& results) {
+    if constexpr (is_tuple<T>::value) {
+        luaL_checkstack(lua, static_cast<int32_t>(std::tuple_size_v<T>), nullptr);
+        std::apply([lua](const auto& ...result) {
+            (pushValue(lua, result), ...);
+        }, results);
+        return static_cast<int32_t>(std::tuple_size_v<T>);
+    }
+    else {
+        pushValue(lua, results);
+        return 1;
+    }
+}
+
+// The parameters of a bound function, the leading lua_State* is passed as is.
+template <typename ...params_t>
+struct BindingParams {
+    static constexpr bool takesLua = false;
+    using args_t = std::tuple<std::decay_t<params_t>...>;
+};
+template <typename ...params_t>
+struct BindingParams<lua_State*, params_t...> {
+    static constexpr bool takesLua = true;
+    using args_t = std::tuple<std::decay_t<params_t>...>;
+};
+
+template <typename>
+struct function_traits;
+template <typename result_t, typename ...params_t>
+struct function_traits<result_t(*)(params_t...)> : BindingParams<params_t...> {
+    using result_type = result_t;
+    using params_type = std::tuple<params_t...>;
+};
+template <typename result_t, typename ...params_t>
+struct function_traits<result_t(*)(params_t...) noexcept>
+    : function_traits<result_t(*)(params_t...)> {};
+
+// The arguments and the error record of a binding, kept per Lua state.
+template <typename args_t>
+struct BindingScratch {
+    args_t args;
+    LuaCArgParseError error;
+    bool isInUse = false;
+};
+
+// The scratch is a userdata kept in the registry, it is destroyed along with
+// the Lua state.
+template <typename scratch_t>
+scratch_t& bindingScratch(lua_State* lua, const void* registryKey) {
+    if (lua_rawgetp(lua, LUA_REGISTRYINDEX, registryKey) == LUA_TUSERDATA) {
+        scratch_t* scratch = static_cast<scratch_t*>(lua_touserdata(lua, -1));
+        lua_pop(lua, 1);
+        return *scratch;
+    }
+    lua_pop(lua, 1);
+    scratch_t* scratch = new (lua_newuserdatauv(lua, sizeof(scratch_t), 0)) scratch_t();
+    lua_createtable(lua, 0, 1);
+    lua_pushcfunction(lua, [](lua_State* lua) -> int32_t {
+        static_cast<scratch_t*>(lua_touserdata(lua, 1))->~scratch_t();
+        return 0;
+    });
+    lua_setfield(lua, -2, "__gc");
+    lua_setmetatable(lua, -2);
+    lua_rawsetp(lua, LUA_REGISTRYINDEX, registryKey);
+    return *scratch;
+}
+
+template <auto fn>
+struct Binding {
+    using traits_t = function_traits<decltype(fn)>;
+    using args_t = typename traits_t::args_t;
+    using scratch_t = BindingScratch<args_t>;
+
+    template <size_t ...idx>
+    static int32_t invoke(lua_State* lua, args_t& args, std::index_sequence<idx...>) {
+        using params_t = typename traits_t::params_type;
+        constexpr size_t first = traits_t::takesLua ? 1 : 0;
+        const auto call = [lua, &args]() -> decltype(auto) {
+            if constexpr (traits_t::takesLua) {
+                return fn(lua, std::forward<std::tuple_element_t<idx + first, params_t>>(
+                    std::get<idx>(args))...);
+            }
+            else {
+                return fn(std::forward<std::tuple_element_t<idx + first, params_t>>(
+                    std::get<idx>(args))...);
+            }
+        };
+        if constexpr (std::is_void_v<typename traits_t::result_type>) {
+            call();
+            return 0;
+        }
+        else {
+            return pushResults(lua, call());
+        }
+    }
+
+    // Returns the number of results, or -1 if the arguments are wrong.
+    static int32_t parseAndCall(lua_State* lua, scratch_t& scratch) {
+        scratch.error.clear();
+        LuaCArgParseMeta meta;
+        meta.lua = lua;
+        meta.error = &scratch.error;
+        meta.argsNumber = lua_gettop(lua);
+        meta.argIdx = 0;
+        // The arguments are left on the stack, the results are pushed above.
+        if (!processTuple(meta, scratch.args)) {
+            if (scratch.error.empty()) {
+                scratch.error.code = LuaCArgParseError::Code::WrongArgumentsNumber;
+            }
+            return -1;
+        }
+        return invoke(lua, scratch.args,
+            std::make_index_sequence<std::tuple_size_v<args_t>>());
+    }
+
+    // Runs parseAndCall for the scratch given as the light userdata at 1,
+    // the arguments follow it. The wrong arguments are left in the scratch.
+    static int32_t protectedCall(lua_State* lua) {
+        scratch_t& scratch = *static_cast<scratch_t*>(lua_touserdata(lua, 1));
+        lua_remove(lua, 1);
+        return std::max(parseAndCall(lua, scratch), 0);
+    }
+
+    // An error raised by fn would longjmp over the C++ frames, so fn is called
+    // under lua_pcall: the error comes back here and is raised again once the
+    // scratch is released. The by-value parameters made in invoke are skipped
+    // all the same. Returns the number of the results, -1 if the
+    // arguments are wrong, or raisedByFn with the error on the top.
+    static constexpr int32_t raisedByFn = -2;
+    static int32_t callProtected(lua_State* lua, scratch_t& scratch) {
+        const int32_t argsNumber = lua_gettop(lua);
+        lua_pushcfunction(lua, &protectedCall);
+        lua_pushlightuserdata(lua, &scratch);
+        lua_rotate(lua, 1, 2);
+        if (lua_pcall(lua, argsNumber + 1, LUA_MULTRET, 0) != LUA_OK) {
+            return raisedByFn;
+        }
+        return scratch.error.empty() ? lua_gettop(lua) : -1;
+    }
+
+    static int32_t call(lua_State* lua) {
+        // Its address is the registry key of the binding.
+        static char registryKey = 0;
+        scratch_t& scratch = bindingScratch<scratch_t>(lua, &registryKey);
+        LuaCArgParseError error;
+        int32_t resultsNumber = 0;
+        if (!scratch.isInUse) {
+            scratch.isInUse = true;
+            resultsNumber = callProtected(lua, scratch);
+            scratch.isInUse = false;
+            if (resultsNumber == -1) {
+                error = scratch.error;
+            }
+        }
+        else {
+            // A recursive call gets its own arguments, they are destroyed
+            // before raising.
+            scratch_t local;
+            resultsNumber = callProtected(lua, local);
+            if (resultsNumber == -1) {
+                error = local.error;
+            }
+        }
+        if (resultsNumber == raisedByFn) {
+            return lua_error(lua);
+        }
+        if (resultsNumber < 0) {
+            return raiseError(lua, error);
+        }
+        return resultsNumber;
+    }
+};
+
+// A binding that converts at most chunkSize elements of the vector arguments
+// at once and yields in between when called from a coroutine.
+template <auto fn, lua_Unsigned chunkSize>
+struct YieldableBinding {
+    static_assert(chunkSize != 0, "chunks must not be empty");
+    using binding_t = Binding<fn>;
+    using args_t = typename binding_t::args_t;
+
+    // The state of a call, a userdata right above the arguments. It outlives
+    // the yields and is destroyed by the collector, also after an error.
+    struct State {
+        args_t args;
+        LuaCArgParseCursor cursor;
+        int32_t argsNumber = 0;
+        // The stack top to restore after a yield, the values passed to
+        // coroutine.resume are pushed above it.
+        int32_t top = 0;
+    };
+
+    static int32_t call(lua_State* lua) {
+        const int32_t argsNumber = lua_gettop(lua);
+        State* state = new (lua_newuserdatauv(lua, sizeof(State), 0)) State();
+        lua_createtable(lua, 0, 1);
+        lua_pushcfunction(lua, [](lua_State* lua) -> int32_t {
+            static_cast<State*>(lua_touserdata(lua, 1))->~State();
+            return 0;
+        });
+        lua_setfield(lua, -2, "__gc");
+        lua_setmetatable(lua, -2);
+        state->argsNumber = argsNumber;
+        state->top = lua_gettop(lua);
+        return resume(lua, LUA_OK, static_cast<lua_KContext>(state->top));
+    }
+
+    static int32_t resume(lua_State* lua, int32_t /*status*/, const lua_KContext stateIdx) {
+        State* state = static_cast<State*>(lua_touserdata(lua, static_cast<int32_t>(stateIdx)));
+        lua_settop(lua, state->top);
+        LuaCArgParseError error;
+        LuaCArgParseMeta meta;
+        meta.lua = lua;
+        meta.error = &error;
+        meta.argsNumber = state->argsNumber;
+        bool ok = false;
+        while (!processTupleChunk(meta, state->args, state->cursor, chunkSize, ok)) {
+            if (lua_isyieldable(lua)) {
+                state->top = lua_gettop(lua);
+                return lua_yieldk(lua, 0, stateIdx, &resume);
+            }
+        }
+        if (!ok) {
+            return raiseError(lua, error);
+        }
+        return binding_t::invoke(lua, state->args,
+            std::make_index_sequence<std::tuple_size_v<args_t>>());
+    }
+};
+
+// A binding taking a table of rows, each row is a table of the arguments of
+// one call. The rows are unpacked onto the stack of a scratch thread, so
+// their arguments get the indexes 1..n the parsing expects.
+template <auto fn>
+struct BatchBinding {
+    using binding_t = Binding<fn>;
+    using args_t = typename binding_t::args_t;
+    using scratch_t = typename binding_t::scratch_t;
+
+    static constexpr int32_t rowsIdx = 1;
+    static constexpr int32_t threadIdx = 2;
+    static constexpr int32_t errorsIdx = 3;
+
+    // Sets errors[row] to the message of the error.
+    static void addError(lua_State* lua, const lua_Integer row, const LuaCArgParseError& error) {
+        if (lua_isnil(lua, errorsIdx)) {
+            lua_newtable(lua);
+            lua_replace(lua, errorsIdx);
+        }
+        pushErrorMessage(lua, error);
+        lua_rawseti(lua, errorsIdx, row);
+    }
+
+    // Pushes the scratch thread of the binding. It is kept in the registry
+    // like the scratch arguments, so a batch does not create a thread.
+    static lua_State* pushThread(lua_State* lua) {
+        // Its address is the registry key of the thread.
+        static char registryKey = 0;
+        if (lua_rawgetp(lua, LUA_REGISTRYINDEX, &registryKey) != LUA_TTHREAD) {
+            lua_pop(lua, 1);
+            lua_newthread(lua);
+            lua_pushvalue(lua, -1);
+            lua_rawsetp(lua, LUA_REGISTRYINDEX, &registryKey);
+        }
+        return lua_tothread(lua, -1);
+    }
+
+    // Returns the number of the rows passed to fn.
+    static lua_Integer callRows(lua_State* lua, lua_State* thread, scratch_t& scratch) {
+        const lua_Unsigned rowsNumber = lua_rawlen(lua, rowsIdx);
+        LuaCArgParseMeta meta;
+        meta.lua = thread;
+        meta.error = &scratch.error;
+        lua_Integer calls = 0;
+        for (lua_Integer row = 1; static_cast<lua_Unsigned>(row) <= rowsNumber; ++row) {
+            scratch.error.clear();
+            if (lua_rawgeti(lua, rowsIdx, row) != LUA_TTABLE) {
+                LuaCArgParseMeta rowMeta;
+                rowMeta.lua = lua;
+                rowMeta.error = &scratch.error;
+                rowMeta.argIdx = -1;
+                setError(rowMeta, LuaCArgParseError::Code::TableExpected, -1);
+                rowMeta.argIdx = rowsIdx;
+                lua_pushinteger(lua, row);
+                pushErrorKey(rowMeta, -1);
+                lua_settop(lua, errorsIdx);
+                addError(lua, row, scratch.error);
+                continue;
+            }
+            lua_settop(thread, 0);
+            lua_xmove(lua, thread, 1);
+            const lua_Unsigned length = lua_rawlen(thread, 1);
+            if (length > static_cast<lua_Unsigned>(INT32_MAX - 1)
+                    || !lua_checkstack(thread, static_cast<int32_t>(length))) {
+                scratch.error.code = LuaCArgParseError::Code::WrongArgumentsNumber;
+                addError(lua, row, scratch.error);
+                continue;
+            }
+            const int32_t argsNumber = static_cast<int32_t>(length);
+            for (int32_t arg = 1; arg <= argsNumber; ++arg) {
+                lua_rawgeti(thread, 1, arg);
+            }
+            lua_remove(thread, 1);
+            meta.argsNumber = argsNumber;
+            meta.argIdx = 0;
+            // The arguments stay on the thread while fn is called.
+            if (!processTuple(meta, scratch.args)) {
+                if (scratch.error.empty()) {
+                    scratch.error.code = LuaCArgParseError::Code::WrongArgumentsNumber;
+                }
+                addError(lua, row, scratch.error);
+                continue;
+            }
+            binding_t::invoke(lua, scratch.args,
+                std::make_index_sequence<std::tuple_size_v<args_t>>());
+            // The results are dropped.
+            lua_settop(lua, errorsIdx);
+            ++calls;
+        }
+        lua_settop(thread, 0);
+        return calls;
+    }
+
+    // Runs callRows for the scratch given as the light userdata at 1, the
+    // stack of call follows it. Returns the number of the calls and errors.
+    static int32_t protectedRows(lua_State* lua) {
+        scratch_t& scratch = *static_cast<scratch_t*>(lua_touserdata(lua, 1));
+        lua_remove(lua, 1);
+        lua_pushinteger(lua, callRows(lua, lua_tothread(lua, threadIdx), scratch));
+        lua_pushvalue(lua, errorsIdx);
+        return 2;
+    }
+
+    // Like Binding::callProtected, an error raised by fn is raised again
+    // once the scratch is released. Returns whether fn raised it.
+    static bool callRowsProtected(lua_State* lua, scratch_t& scratch) {
+        lua_pushcfunction(lua, &protectedRows);
+        lua_pushlightuserdata(lua, &scratch);
+        lua_rotate(lua, 1, 2);
+        return lua_pcall(lua, errorsIdx + 1, 2, 0) != LUA_OK;
+    }
+
+    static int32_t call(lua_State* lua) {
+        if (lua_gettop(lua) != 1 || lua_type(lua, rowsIdx) != LUA_TTABLE) {
+            LuaCArgParseError error;
+            LuaCArgParseMeta meta;
+            meta.lua = lua;
+            meta.error = &error;
+            meta.argIdx = rowsIdx;
+            if (lua_gettop(lua) != 1) {
+                error.code = LuaCArgParseError::Code::WrongArgumentsNumber;
+            }
+            else {
+                setError(meta, LuaCArgParseError::Code::TableExpected, rowsIdx);
+            }
+            return raiseError(lua, error);
+        }
+        // Its address is the registry key of the binding.
+        static char registryKey = 0;
+        scratch_t& scratch = bindingScratch<scratch_t>(lua, &registryKey);
+        bool isRaisedByFn = false;
+        if (!scratch.isInUse) {
+            pushThread(lua);
+            lua_pushnil(lua);
+            scratch.isInUse = true;
+            isRaisedByFn = callRowsProtected(lua, scratch);
+            scratch.isInUse = false;
+        }
+        else {
+            // A batch called from fn gets its own thread and arguments.
+            lua_newthread(lua);
+            lua_pushnil(lua);
+            scratch_t local;
+            isRaisedByFn = callRowsProtected(lua, local);
+        }
+        if (isRaisedByFn) {
+            return lua_error(lua);
+        }
+        return 2;
+    }
+};
+
+// Snapshots. The capture walks the arguments like the parsers above, with the
+// same checks and errors, but appends the values to the cells of the snapshot
+// instead of building them. It follows only the shape of args_t, so a table
+// nested deeper than args_t (or a cyclic one) is never walked.
+
+inline LuaCArgParseMeta nestedMeta(const LuaCArgParseMeta& meta) {
+    LuaCArgParseMeta valueMeta;
+    valueMeta.lua = meta.lua;
+    valueMeta.error = meta.error;
+    valueMeta.memoryResource = meta.memoryResource;
+    valueMeta.skipMissingFields = meta.skipMissingFields;
+    valueMeta.rejectExtraFields = meta.rejectExtraFields;
+    return valueMeta;
+}
+
+template <typename T, typename snapshot_t>
+bool captureValue(LuaCArgParseMeta& meta, snapshot_t& snapshot);
+
+template <typename T, typename snapshot_t>
+bool captureScalar(LuaCArgParseMeta& meta, snapshot_t& snapshot, const bool quiet) {
+    if constexpr (std::is_integral_v<T>) {
+        T value = 0;
+        if (!processInteger<T>(meta, value, quiet)) {
+            return false;
+        }
+        snapshot.cells.emplace_back().integer = static_cast<lua_Integer>(value);
+    }
+    else if constexpr (std::is_floating_point_v<T>) {
+        T value = 0;
+        if (!processFloat<T>(meta, value, quiet)) {
+            return false;
+        }
+        snapshot.cells.emplace_back().number = static_cast<lua_Number>(value);
+    }
+    else {
+        static_assert(!std::is_same_v<T, std::string_view> && !std::is_same_v<T, const char*>,
+            "a snapshot can't keep the Lua strings, use std::string");
+        std::string_view value;
+        if (!processString<std::string_view>(meta, value, quiet)) {
+            return false;
+        }
+        snapshot.cells.emplace_back().size = snapshot.bytes.size();
+        snapshot.cells.emplace_back().size = value.size();
+        snapshot.bytes.append(value);
+    }
+    return true;
+}
+
+// The size, then a key and an element for each entry.
+template <typename arg_t, typename snapshot_t>
+bool captureVector(LuaCArgParseMeta& meta, snapshot_t& snapshot) {
+    static_assert(std::is_arithmetic_v<arg_t> || is_string<arg_t>::value
+        || is_variant<arg_t>::value, "prohibited combination");
+    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
+        setError(meta, LuaCArgParseError::Code::TableExpected, meta.argIdx);
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    const int32_t tableIdx = lua_absindex(meta.lua, meta.argIdx);
+    const lua_Unsigned length = lua_rawlen(meta.lua, tableIdx);
+    snapshot.cells.emplace_back().size = static_cast<size_t>(length);
+    LuaCArgParseMeta valueMeta = nestedMeta(meta);
+    lua_Unsigned count = 0;
+    bool ok = true;
+    lua_pushnil(meta.lua);
+    while (ok && lua_next(meta.lua, tableIdx) != 0) {
+        // key at -2 and value at -1
+        lua_Integer keyValue = 0;
+        ok = readSequenceKey(meta, length, keyValue);
+        if (ok) {
+            snapshot.cells.emplace_back().integer = keyValue;
+            valueMeta.argIdx = -1;
+            ok = captureValue<arg_t>(valueMeta, snapshot);
+            if (ok) {
+                ++count;
+            }
+            else {
+                pushErrorKey(meta, -2);
+            }
+        }
+        // The key is kept for the next iteration, both go on a failure.
+        lua_pop(meta.lua, ok ? 1 : 2);
+    }
+    if (ok && count != length) {
+        setError(meta, LuaCArgParseError::Code::WrongKeySequence, meta.argIdx);
+        ok = false;
+    }
+    if (!ok) {
+        meta.argIdx = INT32_MIN;
+    }
+    return ok;
+}
+
+// The number of the entries, then a key and a value for each of them.
+template <typename res_t, typename snapshot_t>
+bool captureMap(LuaCArgParseMeta& meta, snapshot_t& snapshot) {
+    using key_t = typename is_map<res_t>::key_type;
+    using value_t = typename is_map<res_t>::mapped_type;
+    static_assert(std::is_arithmetic_v<key_t> || is_string<key_t>::value,
+        "prohibited combination");
+    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
+        setError(meta, LuaCArgParseError::Code::TableExpected, meta.argIdx);
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    const int32_t tableIdx = lua_absindex(meta.lua, meta.argIdx);
+    const size_t countCell = snapshot.cells.size();
+    snapshot.cells.emplace_back();
+    LuaCArgParseMeta parseMeta = nestedMeta(meta);
+    size_t count = 0;
+    bool ok = true;
+    lua_pushnil(meta.lua);
+    while (ok && lua_next(meta.lua, tableIdx) != 0) {
+        // key at -2 and value at -1
+        parseMeta.argIdx = -2;
+        ok = captureScalar<key_t>(parseMeta, snapshot, false);
+        if (ok) {
+            parseMeta.argIdx = -1;
+            ok = captureValue<value_t>(parseMeta, snapshot);
+            if (ok) {
+                ++count;
+            }
+            else {
+                pushErrorKey(meta, -2);
+            }
+        }
+        lua_pop(meta.lua, ok ? 1 : 2);
+    }
+    if (!ok) {
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
+    snapshot.cells[countCell].size = count;
+    return true;
+}
+
+// Whether the field is there, then its value.
+template <typename owner_t, typename member_t, typename snapshot_t>
+bool captureRecordField(LuaCArgParseMeta& meta, LuaCArgParseMeta& valueMeta,
+        const int32_t tableIdx, const int32_t keysIdx, const lua_Integer keyNumber,
+        const LuaCArgParseField<owner_t, member_t>& /*field*/, snapshot_t& snapshot,
+        int32_t& fieldsCount) {
+    using value_t = typename std::conditional_t<is_optional<member_t>::value,
+        member_t, std::optional<member_t>>::value_type;
+    valueMeta.argIdx = -1;
+    const size_t presenceCell = snapshot.cells.size();
+    snapshot.cells.emplace_back().integer = 1;
+    bool ok = true;
+    if (pushField(meta.lua, tableIdx, keysIdx, keyNumber) == LUA_TNIL) {
+        if (is_optional<member_t>::value || meta.skipMissingFields) {
+            snapshot.cells[presenceCell].integer = 0;
+        }
+        else {
+            // Reports the type error.
+            ok = captureValue<value_t>(valueMeta, snapshot);
+        }
+    }
+    else {
+        ++fieldsCount;
+        ok = captureValue<value_t>(valueMeta, snapshot);
+    }
+    lua_pop(meta.lua, 1);
+    if (!ok) {
+        pushFieldErrorKey(meta, keysIdx, keyNumber);
     }
-    if (!meta.errorStr->empty()) {
+    return ok;
+}
+
+template <typename record_t, typename snapshot_t>
+bool captureRecord(LuaCArgParseMeta& meta, snapshot_t& snapshot) {
+    if (lua_type(meta.lua, meta.argIdx) != LUA_TTABLE) {
+        setError(meta, LuaCArgParseError::Code::TableExpected, meta.argIdx);
         meta.argIdx = INT32_MIN;
         return false;
     }
-    res = std::move(map);
+    const int32_t tableIdx = lua_absindex(meta.lua, meta.argIdx);
+    const int32_t keysIdx = pushFieldKeys<record_t>(meta.lua);
+    LuaCArgParseMeta valueMeta = nestedMeta(meta);
+    int32_t fieldsCount = 0;
+    lua_Integer keyNumber = 0;
+    bool ok = std::apply([&](const auto& ...field) {
+        return (captureRecordField(meta, valueMeta, tableIdx, keysIdx, ++keyNumber,
+            field, snapshot, fieldsCount) && ...);
+    }, record_t::luaFields());
+    if (ok && meta.rejectExtraFields) {
+        int32_t entriesCount = 0;
+        lua_pushnil(meta.lua);
+        while (lua_next(meta.lua, tableIdx) != 0) {
+            lua_pop(meta.lua, 1);
+            ++entriesCount;
+        }
+        if (entriesCount != fieldsCount) {
+            setUnknownFieldError<record_t>(meta, tableIdx, keysIdx);
+            ok = false;
+        }
+    }
+    // Remove the keys.
+    lua_pop(meta.lua, 1);
+    if (!ok) {
+        meta.argIdx = INT32_MIN;
+    }
     return ok;
 }
 
-struct VariantVisitor {
-    LuaCArgParseMeta* meta = nullptr;
-    bool success = false;
-
-    template <typename arg_t, typename ...args_t>
-    bool operator()(std::variant<args_t...>& arg) {
-        using T = arg_t;
-#ifdef _DEBUG
-        const auto lua_type_test = lua_typename(meta->lua, lua_type(meta->lua, meta->argIdx));
-        (void)lua_type_test;
-#endif // _DEBUG
-        if constexpr (std::is_integral_v<T>) {
-            success = processInteger<T>(*meta, arg, true);
-        }
-        else if constexpr (std::is_floating_point_v<T>) {
-            success = processFloat<T>(*meta, arg, true);
-        }
-        else if constexpr (std::is_same_v<T, std::string>) {
-            success = processString(*meta, arg, true);
-        }
-        else if constexpr (std::is_same_v<T, std::nullptr_t>) {
-            return false;
+// The index of the alternative, then its value. A failed alternative leaves
+// nothing in the snapshot, see VariantVisitor.
+template <typename T, typename snapshot_t>
+bool captureAlternative(LuaCArgParseMeta& meta, snapshot_t& snapshot, const size_t idx,
+        std::optional<LuaCArgParseError>& firstError) {
+    const size_t cellsSize = snapshot.cells.size();
+    const size_t bytesSize = snapshot.bytes.size();
+    snapshot.cells.emplace_back().size = idx;
+    if constexpr (std::is_arithmetic_v<T> || is_string<T>::value) {
+        if (captureScalar<T>(meta, snapshot, true)) {
+            return true;
         }
-        else if constexpr (is_vector<T>::value) {
-            success = processVector<typename T::value_type>(*meta, arg, true);
-            if (meta->argIdx == INT32_MIN) {
-                // Error, abort processing.
+    }
+    else if constexpr (is_vector<T>::value || is_map<T>::value || is_record<T>::value) {
+        if (probeValue<T>(meta.lua, meta.argIdx)) {
+            const int32_t argIdx = meta.argIdx;
+            if (captureValue<T>(meta, snapshot)) {
                 return true;
             }
-        }
-        else if constexpr (is_map<T>::value) {
-            success = processMap<typename T::key_type, typename T::mapped_type>(
-                *meta, arg, true);
-            if (meta->argIdx == INT32_MIN) {
-                // Error, abort processing.
-                return true;
+            if (!firstError.has_value()) {
+                firstError = *meta.error;
             }
+            meta.error->clear();
+            meta.argIdx = argIdx;
         }
-        else if constexpr (is_optional<T>::value) {
-            static_assert(always_false<T>::value, "optional is not allowed in variant");
-        }
-        else if constexpr (is_variant<T>::value) {
-            static_assert(always_false<T>::value, "variant is not allowed in variant");
-        }
-        else if constexpr (is_tuple<T>::value) {
-            static_assert(always_false<T>::value, "tuple is not allowed in variant");
+    }
+    else if constexpr (!std::is_same_v<T, std::nullptr_t>) {
+        static_assert(always_false<T>::value, "not supported by snapshots");
+    }
+    snapshot.cells.resize(cellsSize);
+    snapshot.bytes.resize(bytesSize);
+    return false;
+}
+
+template <typename ...args_t, typename snapshot_t, size_t ...idx>
+bool captureAlternatives(LuaCArgParseMeta& meta, snapshot_t& snapshot, const uint64_t candidates,
+        std::optional<LuaCArgParseError>& firstError, std::index_sequence<idx...>) {
+    return ((((candidates >> idx) & 1) != 0
+        && captureAlternative<args_t>(meta, snapshot, idx, firstError)) || ...);
+}
+
+template <typename ...args_t, typename snapshot_t>
+bool captureVariant(LuaCArgParseMeta& meta, snapshot_t& snapshot, std::variant<args_t...>*) {
+    static constexpr auto candidates = variantCandidates<args_t...>();
+    const LuaTag tag = luaTag(meta.lua, meta.argIdx);
+    if (tag == LuaTag::None) {
+        setError(meta, LuaCArgParseError::Code::WrongArgumentsNumber, meta.argIdx);
+        return false;
+    }
+    std::optional<LuaCArgParseError> firstError;
+    if (captureAlternatives<args_t...>(meta, snapshot, candidates[static_cast<size_t>(tag)],
+            firstError, std::index_sequence_for<args_t...>())) {
+        return true;
+    }
+    if (firstError.has_value()) {
+        *meta.error = *firstError;
+        meta.argIdx = INT32_MIN;
+    }
+    else if (meta.error->empty()) {
+        setError(meta, LuaCArgParseError::Code::NoSuitableVariant, meta.argIdx);
+    }
+    return false;
+}
+
+template <typename T, typename snapshot_t>
+bool captureValue(LuaCArgParseMeta& meta, snapshot_t& snapshot) {
+    if constexpr (std::is_arithmetic_v<T> || is_string<T>::value) {
+        return captureScalar<T>(meta, snapshot, false);
+    }
+    else if constexpr (is_vector<T>::value) {
+        return captureVector<typename T::value_type>(meta, snapshot);
+    }
+    else if constexpr (is_map<T>::value) {
+        return captureMap<T>(meta, snapshot);
+    }
+    else if constexpr (is_record<T>::value) {
+        return captureRecord<T>(meta, snapshot);
+    }
+    else if constexpr (is_variant<T>::value) {
+        return captureVariant(meta, snapshot, static_cast<T*>(nullptr));
+    }
+    else if constexpr (is_matrix<T>::value || is_columns<T>::value || is_view<T>::value) {
+        static_assert(always_false<T>::value, "not supported by snapshots");
+    }
+    else {
+        static_assert(always_false<T>::value, "prohibited combination");
+    }
+}
+
+// An optional argument is a presence cell followed by its value.
+template <typename T, typename snapshot_t>
+bool captureArgument(LuaCArgParseMeta& meta, snapshot_t& snapshot, bool& isOnlyOptionalAllowed) {
+    ++meta.argIdx;
+    if constexpr (is_optional<T>::value) {
+        using value_t = typename T::value_type;
+        static_assert(std::is_arithmetic_v<value_t> || is_string<value_t>::value
+            || is_variant<value_t>::value, "prohibited combination");
+        isOnlyOptionalAllowed = true;
+        if (meta.argIdx > meta.argsNumber) {
+            --meta.argIdx;
+            snapshot.cells.emplace_back().integer = 0;
+            return true;
         }
-        else {
-            static_assert(always_false<T>::value, "prohibited combination");
+        snapshot.cells.emplace_back().integer = 1;
+        return captureValue<value_t>(meta, snapshot);
+    }
+    else {
+        if (isOnlyOptionalAllowed) {
+            setError(meta, LuaCArgParseError::Code::OptionalMustBeLast, meta.argIdx);
+            meta.argIdx = INT32_MIN;
+            return false;
         }
-        return success;
+        return captureValue<T>(meta, snapshot);
     }
-};
+}
 
-struct TupleVisitor {
-    LuaCArgParseMeta* meta = nullptr;
+template <typename ...args_t, typename snapshot_t>
+bool captureTuple(LuaCArgParseMeta& meta, snapshot_t& snapshot, std::tuple<args_t...>* tuple) {
+    if (!checkArgumentTypes(meta, tuple)) {
+        meta.argIdx = INT32_MIN;
+        return false;
+    }
     bool isOnlyOptionalAllowed = false;
+    (captureArgument<args_t>(meta, snapshot, isOnlyOptionalAllowed) && ...);
+    return meta.argIdx == meta.argsNumber && meta.error->empty();
+}
 
-    template<typename arg_t>
-    bool operator()(arg_t&& arg) {
-        using T = std::decay_t<decltype(arg)>;
-        meta->errorStr->clear();
-        ++meta->argIdx;
-#ifdef _DEBUG
-        const auto lua_type_test = lua_typename(meta->lua, lua_type(meta->lua, meta->argIdx));
-        (void)lua_type_test;
-#endif // _DEBUG
-        if (isOnlyOptionalAllowed) {
-            if constexpr (!is_optional<T>::value) {
-                *meta->errorStr = "optional must be last";
-                meta->argIdx = INT32_MIN;
-                return false;
-            }
-        }
-        if constexpr (std::is_integral_v<T>) {
-            return processInteger<T>(*meta, arg, false);
-        }
-        else if constexpr (std::is_floating_point_v<T>) {
-            return processFloat<T>(*meta, arg, false);
-        }
-        else if constexpr (std::is_same_v<T, std::string>) {
-            return processString(*meta, arg, false);
+// The build reads the cells back in the same order. They are already
+// checked, so it can't fail and never touches a Lua state.
+
+template <typename T, typename snapshot_t>
+void buildValue(const snapshot_t& snapshot, size_t& cellIdx, T& value);
+
+template <typename T, typename snapshot_t>
+void buildOptional(const snapshot_t& snapshot, size_t& cellIdx, std::optional<T>& optional) {
+    if (snapshot.cells[cellIdx++].integer == 0) {
+        optional.reset();
+        return;
+    }
+    if (!optional.has_value()) {
+        optional.emplace();
+    }
+    buildValue(snapshot, cellIdx, *optional);
+}
+
+template <typename owner_t, typename member_t, typename snapshot_t, typename record_t>
+void buildRecordField(const snapshot_t& snapshot, size_t& cellIdx,
+        const LuaCArgParseField<owner_t, member_t>& field, record_t& res) {
+    member_t& member = res.*field.member;
+    if constexpr (is_optional<member_t>::value) {
+        buildOptional(snapshot, cellIdx, member);
+    }
+    else if (snapshot.cells[cellIdx++].integer != 0) {
+        buildValue(snapshot, cellIdx, member);
+    }
+}
+
+template <typename ...args_t, typename snapshot_t, size_t ...idx>
+void buildVariant(const snapshot_t& snapshot, size_t& cellIdx,
+        std::variant<args_t...>& variant, std::index_sequence<idx...>) {
+    const size_t alternative = snapshot.cells[cellIdx++].size;
+    // Keeps the storage of the alternative that is already there.
+    ((alternative == idx
+        && (variant.index() == idx || (variant.template emplace<idx>(), true))
+        && (buildValue(snapshot, cellIdx, std::get<idx>(variant)), true)) || ...);
+}
+
+template <typename T, typename snapshot_t>
+void buildValue(const snapshot_t& snapshot, size_t& cellIdx, T& value) {
+    if constexpr (std::is_integral_v<T>) {
+        value = static_cast<T>(snapshot.cells[cellIdx++].integer);
+    }
+    else if constexpr (std::is_floating_point_v<T>) {
+        value = static_cast<T>(snapshot.cells[cellIdx++].number);
+    }
+    else if constexpr (is_string<T>::value) {
+        const size_t offset = snapshot.cells[cellIdx++].size;
+        const size_t length = snapshot.cells[cellIdx++].size;
+        value.assign(snapshot.bytes.data() + offset, length);
+    }
+    else if constexpr (is_vector<T>::value) {
+        const size_t size = snapshot.cells[cellIdx++].size;
+        value.resize(size);
+        for (size_t i = 0; i < size; ++i) {
+            const lua_Integer key = snapshot.cells[cellIdx++].integer;
+            buildValue(snapshot, cellIdx, value[static_cast<size_t>(key - 1)]);
         }
-        else if constexpr (is_variant<T>::value) {
-            return processVariant(*meta, arg);
+    }
+    else if constexpr (is_map<T>::value) {
+        using key_t = typename is_map<T>::key_type;
+        const size_t count = snapshot.cells[cellIdx++].size;
+        value.clear();
+        if constexpr (is_flat_map<T>::value) {
+            value.resize(count);
+            for (auto& entry : value) {
+                buildValue(snapshot, cellIdx, entry.first);
+                buildValue(snapshot, cellIdx, entry.second);
+            }
+            // The same as processMap does.
+            const auto less = [](const auto& left, const auto& right) {
+                return std::less<key_t>()(left.first, right.first);
+            };
+            std::sort(value.begin(), value.end(), less);
+            value.erase(std::unique(value.begin(), value.end(),
+                [&less](const auto& left, const auto& right) {
+                    return !less(left, right) && !less(right, left);
+                }), value.end());
         }
-        else if constexpr (is_optional<T>::value) {
-            isOnlyOptionalAllowed = true;
-            return processOptional(*meta, arg);
+        else {
+            if constexpr (is_unordered_map<T>::value) {
+                value.reserve(count);
+            }
+            for (size_t i = 0; i < count; ++i) {
+                key_t key{};
+                buildValue(snapshot, cellIdx, key);
+                buildValue(snapshot, cellIdx, value[std::move(key)]);
+            }
         }
-        else if constexpr (is_vector<T>::value) {
-            return processVector<typename T::value_type>(*meta, arg, false);
+    }
+    else if constexpr (is_record<T>::value) {
+        std::apply([&](const auto& ...field) {
+            (buildRecordField(snapshot, cellIdx, field, value), ...);
+        }, T::luaFields());
+    }
+    else if constexpr (is_variant<T>::value) {
+        buildVariant(snapshot, cellIdx, value, std::make_index_sequence<std::variant_size_v<T>>());
+    }
+    else if constexpr (is_optional<T>::value) {
+        buildOptional(snapshot, cellIdx, value);
+    }
+    else if constexpr (!std::is_same_v<T, std::nullptr_t>) {
+        static_assert(always_false<T>::value, "not supported by snapshots");
+    }
+}
+
+} // namespace details
+
+// A lazy view of a sequence argument: the table is only checked to be a table,
+// an element is converted when it is accessed for the first time and cached.
+// Only the arguments themselves can be viewed, e.g.
+//   std::tuple<lua::LuaCArgParseArrayView<int32_t>> args;
+// and cArgParse leaves all the arguments on the stack when there is a view
+// among them. A view is valid until its argument is removed from the stack.
+template <typename T>
+struct LuaCArgParseArrayView {
+    using value_type = T;
+
+    size_t size() const {
+        return length;
+    }
+    // Converts the element idx (from 0). Returns nullptr with an empty error
+    // for an index out of range, and nullptr with the error filled in for
+    // a wrong element.
+    const T* get(const size_t idx, LuaCArgParseError& error) const {
+        error.clear();
+        const auto it = cache.find(idx);
+        if (it != cache.end()) {
+            return &it->second;
         }
-        else if constexpr (is_map<T>::value) {
-            return processMap<typename T::key_type, typename T::mapped_type>(
-                *meta, arg, false);
+        if (idx >= length) {
+            return nullptr;
         }
-        else {
-            static_assert(always_false<T>::value, "prohibited combination");
+        lua_pushinteger(lua, static_cast<lua_Integer>(idx + 1));
+        lua_pushvalue(lua, -1);
+        lua_rawget(lua, tableIdx);
+        // key at -2 and value at -1
+        T value {};
+        const bool ok = details::processViewValue(lua, argIdx, value, error);
+        lua_pop(lua, 2);
+        if (!ok) {
+            return nullptr;
         }
+        return &cache.emplace(idx, std::move(value)).first->second;
     }
+
+    lua_State* lua = nullptr;
+    // Absolute stack index of the table.
+    int32_t tableIdx = 0;
+    int32_t argIdx = 0;
+    size_t length = 0;
+    mutable std::unordered_map<size_t, T> cache;
 };
 
-template <typename ...args_t>
-bool processVariant(LuaCArgParseMeta& meta, std::variant<args_t...>& variant) {
-    if (lua_type(meta.lua, meta.argIdx) == LUA_TNONE) {
-        *meta.errorStr = "wrong arguments number";
-        return false;
+// A lazy view of a map argument, see LuaCArgParseArrayView. A value is looked
+// up by its key when it is asked for.
+template <typename key_t, typename value_t>
+struct LuaCArgParseMapView {
+    static_assert(!std::is_same_v<key_t, const char*>, "use std::string_view keys");
+    using key_type = key_t;
+    using mapped_type = value_t;
+    // The cache owns its keys, a std::string_view key of find() may point
+    // into a buffer of the caller.
+    using cache_key_type = std::conditional_t<std::is_same_v<key_t, std::string_view>,
+        std::string, key_t>;
+
+    // Returns nullptr with an empty error for an absent key, and nullptr with
+    // the error filled in for a wrong value.
+    const value_t* find(const key_t& key, LuaCArgParseError& error) const {
+        error.clear();
+        const auto it = cache.find(key);
+        if (it != cache.end()) {
+            return &it->second;
+        }
+        details::pushValue(lua, key);
+        lua_pushvalue(lua, -1);
+        if (lua_rawget(lua, tableIdx) == LUA_TNIL) {
+            lua_pop(lua, 2);
+            return nullptr;
+        }
+        // key at -2 and value at -1
+        value_t value {};
+        const bool ok = details::processViewValue(lua, argIdx, value, error);
+        lua_pop(lua, 2);
+        if (!ok) {
+            return nullptr;
+        }
+        return &cache.emplace(cache_key_type(key), std::move(value)).first->second;
     }
-    VariantVisitor visitor;
-    visitor.meta = &meta;
-    foreach_(visitor, variant);
-    if (!visitor.success && meta.errorStr->empty()) {
-        *meta.errorStr = "no suitable variant";
+    // Calls callback(const key_t&, const value_t&) for every entry, a false
+    // result stops the traversal. The callback must leave the stack as is.
+    // Returns false on a wrong entry.
+    template <typename callback_t>
+    bool forEach(callback_t&& callback, LuaCArgParseError& error) const {
+        error.clear();
+        details::LuaCArgParseMeta keyMeta;
+        keyMeta.lua = lua;
+        keyMeta.error = &error;
+        lua_pushnil(lua);
+        while (lua_next(lua, tableIdx) != 0) {
+            // key at -2 and value at -1
+            key_t key {};
+            keyMeta.argIdx = -2;
+            bool ok = details::processValue(keyMeta, key);
+            const value_t* value = nullptr;
+            if (ok) {
+                auto it = cache.find(key);
+                if (it == cache.end()) {
+                    value_t parsed {};
+                    ok = details::processViewValue(lua, argIdx, parsed, error);
+                    if (ok) {
+                        it = cache.emplace(cache_key_type(key), std::move(parsed)).first;
+                    }
+                }
+                if (ok) {
+                    value = &it->second;
+                }
+            }
+            if (!ok) {
+                lua_pop(lua, 2);
+                return false;
+            }
+            if (!callback(static_cast<const key_t&>(key), *value)) {
+                lua_pop(lua, 2);
+                return true;
+            }
+            lua_pop(lua, 1);
+        }
+        return true;
     }
-    return visitor.success;
-}
 
-template <typename ...args_t>
-bool processTuple(LuaCArgParseMeta& meta, std::tuple<args_t...>& tuple) {
-    TupleVisitor visitor;
-    visitor.meta = &meta;
-    foreach_(visitor, tuple);
-    return meta.argIdx == meta.argsNumber && meta.errorStr->empty();
-}
-
-} // namespace details
+    lua_State* lua = nullptr;
+    // Absolute stack index of the table.
+    int32_t tableIdx = 0;
+    int32_t argIdx = 0;
+    mutable std::map<cache_key_type, value_t, std::less<>> cache;
+};
 
 
 template <typename ...args_t>
-bool cArgParse(lua_State* lua, std::tuple<args_t...>& args, std::string& errorStr) {
-    errorStr.clear();
+bool cArgParse(lua_State* lua, std::tuple<args_t...>& args, LuaCArgParseError& error,
+        const LuaCArgParseOptions& options = {}) {
+    error.clear();
     details::LuaCArgParseMeta meta;
     meta.lua = lua;
-    meta.errorStr = &errorStr;
+    meta.error = &error;
+    meta.memoryResource = options.memoryResource;
+    meta.skipMissingFields = options.skipMissingFields;
+    meta.rejectExtraFields = options.rejectExtraFields;
     meta.argsNumber = lua_gettop(lua);
     meta.argIdx = 0;
     const bool ok = details::processTuple(meta, args);
-    lua_pop(lua, meta.argsNumber);
+    // The views refer to their tables on the stack.
+    constexpr bool hasViews = (details::is_view<args_t>::value || ...);
+    if (!options.keepArgs && !hasViews) {
+        lua_pop(lua, meta.argsNumber);
+    }
     if (ok) {
         return true;
     }
-    if (!errorStr.empty()) {
+    if (!error.empty()) {
         return false;
     }
     if (meta.argIdx != meta.argsNumber) {
-        errorStr = "wrong arguments number";
+        error.code = LuaCArgParseError::Code::WrongArgumentsNumber;
         return false;
     }
     return true;
 }
 template <typename ...args_t>
-std::tuple<args_t...> cArgParse(lua_State* lua, std::string& errorStr) {
+bool cArgParse(lua_State* lua, std::tuple<args_t...>& args, std::string& errorStr,
+        const LuaCArgParseOptions& options = {}) {
+    LuaCArgParseError error;
+    const bool ok = cArgParse(lua, args, error, options);
+    error.toString(errorStr);
+    return ok;
+}
+template <typename ...args_t>
+std::tuple<args_t...> cArgParse(lua_State* lua, LuaCArgParseError& error,
+        const LuaCArgParseOptions& options = {}) {
+    std::tuple<args_t...> args;
+    cArgParse(lua, args, error, options);
+    return std::move(args);
+}
+template <typename ...args_t>
+std::tuple<args_t...> cArgParse(lua_State* lua, std::string& errorStr,
+        const LuaCArgParseOptions& options = {}) {
     std::tuple<args_t...> args;
-    cArgParse(lua, args, errorStr);
+    cArgParse(lua, args, errorStr, options);
     return std::move(args);
 }
 template <typename ...args_t>
-bool cArgParse(lua_State* lua, std::variant<args_t...>& args, std::string& errorStr) {
-    errorStr.clear();
+bool cArgParse(lua_State* lua, std::variant<args_t...>& args, LuaCArgParseError& error,
+        const LuaCArgParseOptions& options = {}) {
+    error.clear();
     details::LuaCArgParseMeta meta;
     meta.lua = lua;
-    meta.errorStr = &errorStr;
+    meta.error = &error;
+    meta.memoryResource = options.memoryResource;
+    meta.skipMissingFields = options.skipMissingFields;
+    meta.rejectExtraFields = options.rejectExtraFields;
     meta.argsNumber = lua_gettop(lua);
-    meta.argIdx = 1;
-    // since only simple types are allowed in a variant
-    if (meta.argIdx != meta.argsNumber) {
-        errorStr = "wrong arguments number";
+    // The views refer to their tables on the stack.
+    constexpr bool hasViews = (details::has_views<args_t>::value || ...);
+    if constexpr ((details::is_tuple<args_t>::value && ...)) {
+        // A variant of tuples is a set of signatures, see processOverloads.
+        meta.argIdx = 0;
+        const bool ok = details::processOverloads(meta, args);
+        if (!options.keepArgs && !hasViews) {
+            lua_pop(lua, meta.argsNumber);
+        }
+        if (ok) {
+            return true;
+        }
+        if (error.empty()) {
+            error.code = LuaCArgParseError::Code::WrongArgumentsNumber;
+        }
         return false;
     }
-    const bool ok = details::processVariant(meta, args);
-    lua_pop(lua, meta.argsNumber);
-    if (ok) {
+    else {
+        meta.argIdx = 1;
+        // since only simple types are allowed in a variant
+        if (meta.argIdx != meta.argsNumber) {
+            error.code = LuaCArgParseError::Code::WrongArgumentsNumber;
+            return false;
+        }
+        const bool ok = details::processVariant(meta, args);
+        if (!options.keepArgs && !hasViews) {
+            lua_pop(lua, meta.argsNumber);
+        }
+        if (ok) {
+            return true;
+        }
+        if (!error.empty()) {
+            return false;
+        }
         return true;
     }
-    if (!errorStr.empty()) {
-        return false;
-    }
-    return true;
 }
 template <typename ...args_t>
-std::variant<args_t...> cArgParse(lua_State* lua, std::string& errorStr) {
+bool cArgParse(lua_State* lua, std::variant<args_t...>& args, std::string& errorStr,
+        const LuaCArgParseOptions& options = {}) {
+    LuaCArgParseError error;
+    const bool ok = cArgParse(lua, args, error, options);
+    error.toString(errorStr);
+    return ok;
+}
+template <typename ...args_t>
+std::variant<args_t...> cArgParse(lua_State* lua, LuaCArgParseError& error,
+        const LuaCArgParseOptions& options = {}) {
+    std::variant<args_t...> args;
+    cArgParse(lua, args, error, options);
+    return std::move(args);
+}
+template <typename ...args_t>
+std::variant<args_t...> cArgParse(lua_State* lua, std::string& errorStr,
+        const LuaCArgParseOptions& options = {}) {
     std::variant<args_t...> args;
-    cArgParse(lua, args, errorStr);
+    cArgParse(lua, args, errorStr, options);
     return std::move(args);
 }
 
+// Parses the arguments like cArgParse, but raises a Lua error on failure
+// instead of returning it, so the message never goes through a std::string:
+//   std::tuple<int32_t, std::vector<float>> args;
+//   lua::cArgParseOrRaise(L, args);
+// Raising longjmps over the C++ frames when Lua is built as C, skipping their
+// destructors. So on failure args are destroyed and constructed again first,
+// which frees all their storage. An empty std::map or std::unordered_map owns
+// a sentinel node with some standard libraries (MSVC), the ones in args then
+// leak it unless they take their storage from an arena given in the options.
+// The arena must outlive the Lua call, e.g. be kept per thread and released
+// by its owner: a std::pmr::monotonic_buffer_resource in the calling frame is
+// skipped too and leaks its blocks. Don't keep other objects that own
+// resources alive in the calling frame across the call.
+template <typename args_t>
+void cArgParseOrRaise(lua_State* lua, args_t& args, const LuaCArgParseOptions& options = {}) {
+    LuaCArgParseError error;
+    if (cArgParse(lua, args, error, options)) {
+        return;
+    }
+    // Destroyed in full, an assignment would keep the capacity of the strings.
+    args.~args_t();
+    if constexpr (details::is_tuple<args_t>::value) {
+        if (options.memoryResource != nullptr) {
+            // Whatever the new args own comes from the arena.
+            new (&args) args_t(std::allocator_arg,
+                std::pmr::polymorphic_allocator<std::byte>(options.memoryResource));
+            details::raiseError(lua, error);
+            return;
+        }
+    }
+    new (&args) args_t();
+    details::raiseError(lua, error);
+}
+
+// Folds over the sequence argument argIdx without materializing it: every
+// element is converted into one temporary of T, which takes the same types as
+// std::vector elements, and passed to callback(const T&). A false result of
+// the callback stops the traversal. The memory use does not depend on the
+// table size, e.g.
+//   int64_t sum = 0;
+//   lua::cArgForEach<int64_t>(L, 1, [&sum](const int64_t value) {
+//       sum += value;
+//       return true;
+//   }, error);
+// Only the elements 1..#t are visited, in order, other keys are ignored.
+// Returns Completed, Stopped by the callback, or Failed on a wrong element
+// with the error filled in. The arguments are left on the stack.
+template <typename T, typename callback_t>
+LuaCArgForEachResult cArgForEach(lua_State* lua, const int32_t argIdx, callback_t&& callback,
+        LuaCArgParseError& error, const LuaCArgParseOptions& options = {}) {
+    error.clear();
+    details::LuaCArgParseMeta meta;
+    meta.lua = lua;
+    meta.error = &error;
+    meta.memoryResource = options.memoryResource;
+    meta.argsNumber = lua_gettop(lua);
+    meta.argIdx = argIdx;
+    return details::processForEach<T>(meta, callback);
+}
+
+// Pushes a value onto the Lua stack, the reverse of parsing. Takes the same
+// types as cArgParse, a std::tuple is pushed as multiple values. Returns the
+// number of the pushed values, e.g. `return lua::cArgPush(L, results);`.
+template <typename T>
+int32_t cArgPush(lua_State* lua, const T& value) {
+    return details::pushResults(lua, value);
+}
+
+// Makes a batch entry point of a C++ function bound like by cArgBind: it
+// takes a table of rows, each row is a table of the arguments of one call.
+//   static void emit(std::string_view id, double x, double y) { ... }
+//   lua_register(L, "emit_batch", lua::cArgBindBatch<&emit>());
+//   -- calls, errors = emit_batch({ { "a", 1, 2 }, { "b", 3, 4 } })
+// Every row is checked against the same signature and fn is called for each
+// valid one, the results of fn are dropped. Returns the number of the calls
+// and a table of the messages of the wrong rows by their indexes, or nil.
+// The parsing state and the arguments are set up once for the whole batch.
+template <auto fn>
+constexpr lua_CFunction cArgBindBatch() {
+    return &details::BatchBinding<fn>::call;
+}
+
+// Copies the arguments out of the Lua state into the snapshot, on the Lua
+// thread, so that cArgBuild can build them on any other thread. Only the
+// values args_t asks for are copied, and they are checked right away with the
+// same errors as cArgParse reports. The walk follows the shape of args_t, so
+// its depth is bounded by args_t whatever the tables are. The stack is left
+// as is. std::string_view, const char*, views, matrices and columns are not
+// supported.
+template <typename args_t>
+bool cArgSnapshot(lua_State* lua, LuaCArgParseSnapshot<args_t>& snapshot,
+        LuaCArgParseError& error, const LuaCArgParseOptions& options = {}) {
+    static_assert(details::is_tuple<args_t>::value, "the arguments must be a std::tuple");
+    snapshot.cells.clear();
+    snapshot.bytes.clear();
+    error.clear();
+    details::LuaCArgParseMeta meta;
+    meta.lua = lua;
+    meta.error = &error;
+    meta.skipMissingFields = options.skipMissingFields;
+    meta.rejectExtraFields = options.rejectExtraFields;
+    meta.argsNumber = lua_gettop(lua);
+    meta.argIdx = 0;
+    if (details::captureTuple(meta, snapshot, static_cast<args_t*>(nullptr))) {
+        return true;
+    }
+    if (!error.empty()) {
+        return false;
+    }
+    if (meta.argIdx != meta.argsNumber) {
+        error.code = LuaCArgParseError::Code::WrongArgumentsNumber;
+        return false;
+    }
+    return true;
+}
+
+// Builds the arguments from a snapshot made by cArgSnapshot, the same as
+// cArgParse would have built them. No Lua state is involved, so it can run on
+// any thread, also for the same snapshot at once. The containers of args are
+// refilled in place.
+template <typename args_t>
+void cArgBuild(const LuaCArgParseSnapshot<args_t>& snapshot, args_t& args) {
+    size_t cellIdx = 0;
+    std::apply([&snapshot, &cellIdx](auto& ...arg) {
+        (details::buildValue(snapshot, cellIdx, arg), ...);
+    }, args);
+}
+
+// Parses the arguments on an executor: the snapshot is made right away, on
+// the Lua thread, and executor(task) is given a copyable void() task to run
+// on a worker or a pool, which builds the arguments from it.
+//   using Args = std::tuple<std::map<std::string, std::vector<double>>>;
+//   auto future = lua::cArgParseAsync<Args>(L, [&pool](auto task) { pool.post(task); });
+//   ...
+//   lua::LuaCArgParseResult<Args> result = future.get();
+//   if (!result.error.empty()) { ... }
+// A wrong call is not posted, its future is ready at once with the error.
+template <typename args_t, typename executor_t>
+std::future<LuaCArgParseResult<args_t>> cArgParseAsync(lua_State* lua, executor_t&& executor,
+        const LuaCArgParseOptions& options = {}) {
+    LuaCArgParseSnapshot<args_t> snapshot;
+    LuaCArgParseResult<args_t> result;
+    if (!cArgSnapshot(lua, snapshot, result.error, options)) {
+        std::promise<LuaCArgParseResult<args_t>> promise;
+        promise.set_value(std::move(result));
+        return promise.get_future();
+    }
+    auto task = std::make_shared<std::packaged_task<LuaCArgParseResult<args_t>()>>(
+        [snapshot = std::move(snapshot), result = std::move(result)]() mutable {
+            cArgBuild(snapshot, result.args);
+            return std::move(result);
+        });
+    std::future<LuaCArgParseResult<args_t>> future = task->get_future();
+    executor([task]() {
+        (*task)();
+    });
+    return future;
+}
+
+// Makes a lua_CFunction of a C++ function: the arguments are parsed into
+// the tuple of its parameter types, the results are pushed back and a tuple
+// is returned as multiple values. A leading lua_State* parameter gets the
+// state. A parsing error is raised like luaL_error.
+//   static int64_t add(int32_t a, std::optional<int32_t> b) { ... }
+//   lua_register(L, "add", lua::cArgBind<&add>());
+// The arguments are parsed into a scratch tuple kept per Lua state, so the
+// long-lived containers keep their storage between calls, and they stay on
+// the Lua stack, so std::string_view and const char* parameters are safe.
+// fn is called under lua_pcall, a Lua error raised by fn is raised again
+// once the scratch is released. That covers the scratch only: a parameter
+// taken by value is built in the frame of the call and its storage leaks
+// when fn raises, so take containers by const reference.
+template <auto fn>
+constexpr lua_CFunction cArgBind() {
+    return &details::Binding<fn>::call;
+}
+
+// Like cArgBind, but the vector arguments are converted at most chunkSize
+// elements at once. Called from a coroutine, the binding yields after each
+// chunk, so a huge table does not block the other coroutines for long;
+// resume the coroutine (with any values, they are dropped) to go on:
+//   lua_register(L, "sum", lua::cArgBindYieldable<&sum, 4096>());
+// Elsewhere the chunks are converted one after another. The result and the
+// errors are the same as with cArgBind. The tables must not be modified
+// while they are being parsed. Each call keeps its arguments in its own
+// userdata, there is no scratch reused between calls.
+template <auto fn, lua_Unsigned chunkSize>
+constexpr lua_CFunction cArgBindYieldable() {
+    return &details::YieldableBinding<fn, chunkSize>::call;
+}
+
 } // namespace utils::lua
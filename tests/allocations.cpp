@@ -0,0 +1,214 @@
+#include <iostream>
+#include <cstdlib>
+#include <new>
+
+#ifdef _MSC_VER
+#   pragma comment(lib, "lua.lib")
+#endif
+
+#include "../lua_cArgParse.hpp"
+#include "counting_allocator.hpp"
+
+using namespace utils;
+
+// The exact numbers of heap allocations made by parsing, per signature class.
+// Both heaps are counted: the C++ one by the replaced operator new and the
+// Lua one by the lua_Alloc of the state.
+
+// Unlike assert, the checks stay in the release builds, where the numbers
+// matter the most.
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static void check(const bool isPassed, const char* condition, const int32_t line) {
+    if (!isPassed) {
+        std::cout << "allocations.cpp:" << line << ": " << condition << " failed" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static size_t luaAllocationsCount = 0;
+
+static void* countingLuaAlloc(void* /*ud*/, void* ptr, size_t /*osize*/, size_t nsize) {
+    if (nsize == 0) {
+        std::free(ptr);
+        return nullptr;
+    }
+    ++luaAllocationsCount;
+    return std::realloc(ptr, nsize);
+}
+
+// Parses the arguments and returns the numbers of the C++ and the Lua
+// allocations made by cArgParse. With isReused the arguments are kept from
+// the previous call.
+template <bool isReused, typename ...args_t>
+struct Count {
+    static int32_t call(lua_State* lua) {
+        static std::tuple<args_t...> reusedArgs;
+        lua::LuaCArgParseOptions options;
+        // Views need their strings on the stack.
+        options.keepArgs = true;
+        lua::LuaCArgParseError error;
+        const size_t allocationsBefore = allocationsCount;
+        const size_t luaAllocationsBefore = luaAllocationsCount;
+        if constexpr (isReused) {
+            lua::cArgParse(lua, reusedArgs, error, options);
+        }
+        else {
+            std::tuple<args_t...> args;
+            lua::cArgParse(lua, args, error, options);
+        }
+        const size_t allocations = allocationsCount - allocationsBefore;
+        const size_t luaAllocations = luaAllocationsCount - luaAllocationsBefore;
+        lua_pushinteger(lua, static_cast<lua_Integer>(allocations));
+        lua_pushinteger(lua, static_cast<lua_Integer>(luaAllocations));
+        return 2;
+    }
+};
+template <typename ...args_t>
+using Fresh = Count<false, args_t...>;
+template <typename ...args_t>
+using Reused = Count<true, args_t...>;
+
+// Runs `count(args)` twice, the first call warms up the caches, and checks
+// the numbers of the second one.
+static bool expect(lua_State* lua, lua_CFunction count, const char* args,
+        const lua_Integer allocations, const lua_Integer luaAllocations) {
+    lua_register(lua, "count", count);
+    const std::string chunk = std::string("return count(") + args + ")";
+    lua_Integer actual = 0;
+    lua_Integer luaActual = 0;
+    for (int32_t i = 0; i < 2; ++i) {
+        if (luaL_dostring(lua, chunk.c_str()) != LUA_OK) {
+            std::cout << lua_tostring(lua, -1) << std::endl;
+            return false;
+        }
+        actual = lua_tointeger(lua, -2);
+        luaActual = lua_tointeger(lua, -1);
+        lua_pop(lua, 2);
+    }
+    if (actual != allocations || luaActual != luaAllocations) {
+        std::cout << "count(" << args << "): " << actual << " C++ and " << luaActual
+            << " Lua allocations" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+struct Size {
+    int32_t width = 0;
+    int32_t height = 0;
+    static constexpr auto luaFields() {
+        return std::make_tuple(
+            lua::LuaCArgParseField{ "width", &Size::width },
+            lua::LuaCArgParseField{ "height", &Size::height });
+    }
+};
+
+struct Columns {
+    std::vector<double> x;
+    std::vector<double> y;
+    static constexpr auto luaFields() {
+        return std::make_tuple(
+            lua::LuaCArgParseField{ "x", &Columns::x },
+            lua::LuaCArgParseField{ "y", &Columns::y });
+    }
+};
+
+static int64_t sum(const std::vector<int64_t>& values) {
+    int64_t result = 0;
+    for (const int64_t value : values) {
+        result += value;
+    }
+    return result;
+}
+
+int main() {
+    lua_State* lua = lua_newstate(countingLuaAlloc, nullptr);
+    luaL_openlibs(lua);
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    // Scalars, views and records never allocate.
+    CHECK(expect(lua, Fresh<int32_t, std::optional<float>>::call, "1, 0.5", 0, 0));
+    CHECK(expect(lua, Fresh<int32_t, std::optional<float>>::call, "1", 0, 0));
+    CHECK(expect(lua, Fresh<std::variant<int32_t, double, std::string>>::call, "0.5", 0, 0));
+    CHECK(expect(lua, Fresh<std::string_view, const char*>::call,
+        "\"a string longer than the small string buffer\", \"str\"", 0, 0));
+    CHECK(expect(lua, Fresh<Size>::call, "{ width = 640, height = 480 }", 0, 0));
+
+    // Neither does a call rejected up front. A wrong element is met only
+    // after its vector is sized.
+    CHECK(expect(lua, Fresh<int32_t>::call, "\"str\"", 0, 0));
+    CHECK(expect(lua, Fresh<std::vector<int32_t>>::call, "{ 1, 2, \"str\" }", 1, 0));
+    CHECK(expect(lua, Fresh<std::vector<int32_t>, std::string>::call,
+        "{ 1, 2 }, 3", 0, 0));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    // One allocation per buffer.
+    CHECK(expect(lua, Fresh<std::string>::call, "\"str\"", 0, 0));
+    CHECK(expect(lua, Fresh<std::string>::call,
+        "\"a string longer than the small string buffer\"", 1, 0));
+    CHECK(expect(lua, Fresh<std::vector<int32_t>>::call, "{ 1, 2, 3 }", 1, 0));
+    CHECK(expect(lua, Fresh<std::vector<float>>::call, "{ 0.5, 1.5, 2.5 }", 1, 0));
+    CHECK(expect(lua, Fresh<lua::LuaCArgParseMatrix<double>>::call,
+        "{ { 0.5, 1.5 }, { 2.5, 3.5 } }", 1, 0));
+    CHECK(expect(lua, Fresh<lua::LuaCArgParseColumns<Columns>>::call,
+        "{ { x = 0.5, y = 1.5 }, { x = 2.5, y = 3.5 } }", 2, 0));
+    // One node per entry.
+    CHECK(expect(lua, Fresh<std::map<std::string, int32_t>>::call, "{ a = 1, b = 2 }", 2, 0));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    // Long-lived arguments keep their storage.
+    CHECK(expect(lua, Reused<std::string>::call,
+        "\"a string longer than the small string buffer\"", 0, 0));
+    CHECK(expect(lua, Reused<std::vector<int32_t>>::call, "{ 1, 2, 3 }", 0, 0));
+    CHECK(expect(lua, Reused<std::vector<std::string>>::call,
+        "{ \"a string longer than the small string buffer\" }", 0, 0));
+    CHECK(expect(lua, Reused<std::map<std::string, std::vector<double>>>::call,
+        "{ a = { 0.5 }, b = { 1.5, 2.5 } }", 0, 0));
+    CHECK(expect(lua, Reused<std::variant<int32_t, std::vector<int32_t>>>::call,
+        "{ 1, 2, 3 }", 0, 0));
+    CHECK(expect(lua, Reused<lua::LuaCArgParseColumns<Columns>>::call,
+        "{ { x = 0.5, y = 1.5 }, { x = 2.5, y = 3.5 } }", 0, 0));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    // A binding parses into its scratch, a steady call allocates nothing.
+    lua_register(lua, "sum", lua::cArgBind<&sum>());
+    CHECK(luaL_dostring(lua, "values = { 1, 2, 3 } sum(values)") == LUA_OK);
+    lua_getglobal(lua, "sum");
+    lua_getglobal(lua, "values");
+    const size_t allocationsBefore = allocationsCount;
+    const size_t luaAllocationsBefore = luaAllocationsCount;
+    CHECK(lua_pcall(lua, 1, 1, 0) == LUA_OK);
+    CHECK(allocationsCount == allocationsBefore);
+    CHECK(luaAllocationsCount == luaAllocationsBefore);
+    CHECK(lua_tointeger(lua, -1) == 6);
+    lua_pop(lua, 1);
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    // A fold over a table reuses one element, whatever the table size.
+    CHECK(luaL_dostring(lua, "values = { } for i = 1, 10000 do values[i] = \"str\" .. i end") == LUA_OK);
+    lua_getglobal(lua, "values");
+    size_t length = 0;
+    lua::LuaCArgParseError error;
+    const size_t forEachAllocationsBefore = allocationsCount;
+    const size_t forEachLuaAllocationsBefore = luaAllocationsCount;
+    CHECK(lua::cArgForEach<std::string_view>(lua, -1, [&length](const std::string_view value) {
+        length += value.size();
+        return true;
+    }, error) == lua::LuaCArgForEachResult::Completed);
+    CHECK(allocationsCount == forEachAllocationsBefore);
+    CHECK(luaAllocationsCount == forEachLuaAllocationsBefore);
+    CHECK(length == 68894);
+    lua_pop(lua, 1);
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    lua_close(lua);
+    std::cout << "success" << std::endl;
+    return 0;
+}
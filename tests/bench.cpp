@@ -0,0 +1,480 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#ifdef _MSC_VER
+#   pragma comment(lib, "lua.lib")
+#endif
+
+#include "../lua_cArgParse.hpp"
+#include "counting_allocator.hpp"
+
+using namespace utils;
+
+// Output, one line per case and approach:
+//   case,approach,ns_per_call,ns_per_element,allocs_per_call,bytes_per_call
+// "handwritten" is the equivalent binding written with luaL_check*/lua_next.
+
+struct Measurement {
+    double nsPerCall = 0.0;
+    double allocationsPerCall = 0.0;
+    double bytesPerCall = 0.0;
+};
+
+// Calls the global Lua function `name` with the globals listed in `args`
+// (separated by spaces) as its arguments.
+static Measurement measure(lua_State* lua, const char* name, const std::string& args,
+        const int32_t iterations) {
+    std::vector<std::string> argNames;
+    for (size_t begin = 0, end = 0; begin < args.size(); begin = end + 1) {
+        end = std::min(args.find(' ', begin), args.size());
+        argNames.push_back(args.substr(begin, end - begin));
+    }
+    const size_t allocationsBefore = allocationsCount;
+    const size_t bytesBefore = allocatedBytes;
+    const auto begin = std::chrono::steady_clock::now();
+    for (int32_t i = 0; i < iterations; ++i) {
+        lua_getglobal(lua, name);
+        for (const auto& argName : argNames) {
+            lua_getglobal(lua, argName.c_str());
+        }
+        if (lua_pcall(lua, static_cast<int32_t>(argNames.size()), 0, 0) != LUA_OK) {
+            std::cerr << name << "(" << args << "): " << lua_tostring(lua, -1) << std::endl;
+            std::exit(1);
+        }
+    }
+    const auto end = std::chrono::steady_clock::now();
+    Measurement measurement;
+    measurement.nsPerCall =
+        std::chrono::duration<double, std::nano>(end - begin).count() / iterations;
+    measurement.allocationsPerCall =
+        static_cast<double>(allocationsCount - allocationsBefore) / iterations;
+    measurement.bytesPerCall = static_cast<double>(allocatedBytes - bytesBefore) / iterations;
+    return measurement;
+}
+
+// Runs every approach of a case with the same arguments.
+static void compare(lua_State* lua, const char* benchCase, const std::string& args,
+        const int32_t iterations, const int32_t elements,
+        std::initializer_list<std::pair<const char*, lua_CFunction>> approaches) {
+    for (const auto& [approach, function] : approaches) {
+        lua_register(lua, "benchFunction", function);
+        const Measurement measurement = measure(lua, "benchFunction", args, iterations);
+        std::cout << benchCase << "," << approach << "," << measurement.nsPerCall << ","
+            << measurement.nsPerCall / elements << "," << measurement.allocationsPerCall
+            << "," << measurement.bytesPerCall << std::endl;
+    }
+}
+
+// The usual binding of a tuple of arguments.
+template <typename ...args_t>
+struct Parse {
+    static int32_t call(lua_State* lua) {
+        std::tuple<args_t...> args;
+        lua::LuaCArgParseError error;
+        if (!lua::cArgParse(lua, args, error)) {
+            return luaL_error(lua, error.toString().c_str());
+        }
+        return 0;
+    }
+};
+
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+// Scalars and optional tails.
+
+static int32_t scalarsHandwritten(lua_State* lua) {
+    const lua_Integer integer = luaL_checkinteger(lua, 1);
+    luaL_argcheck(lua, integer >= INT32_MIN && integer <= INT32_MAX, 1, "out of range");
+    const double number = luaL_checknumber(lua, 2);
+    size_t len = 0;
+    const char* str = luaL_checklstring(lua, 3, &len);
+    const std::string string(str, len);
+    (void)number;
+    lua_pop(lua, lua_gettop(lua));
+    return 0;
+}
+
+static int32_t optionalsHandwritten(lua_State* lua) {
+    const lua_Integer integer = luaL_checkinteger(lua, 1);
+    luaL_argcheck(lua, integer >= INT32_MIN && integer <= INT32_MAX, 1, "out of range");
+    std::optional<int32_t> optionalInteger;
+    if (!lua_isnoneornil(lua, 2)) {
+        optionalInteger = static_cast<int32_t>(luaL_checkinteger(lua, 2));
+    }
+    std::optional<std::string> optionalString;
+    if (!lua_isnoneornil(lua, 3)) {
+        optionalString = luaL_checkstring(lua, 3);
+    }
+    lua_pop(lua, lua_gettop(lua));
+    return 0;
+}
+
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+// A wide variant, matched by its last alternative.
+
+using WideVariant = std::variant<
+    std::vector<int64_t>,
+    std::map<std::string, int64_t>,
+    int8_t,
+    int32_t,
+    int64_t,
+    float,
+    double,
+    std::string
+>;
+
+static int32_t wideVariantHandwritten(lua_State* lua) {
+    WideVariant arg;
+    switch (lua_type(lua, 1)) {
+    case LUA_TNUMBER:
+        if (lua_isinteger(lua, 1)) {
+            arg = static_cast<int64_t>(lua_tointeger(lua, 1));
+        }
+        else {
+            arg = static_cast<double>(lua_tonumber(lua, 1));
+        }
+        break;
+    case LUA_TSTRING:
+        arg = std::string(lua_tostring(lua, 1));
+        break;
+    default:
+        return luaL_argerror(lua, 1, "no suitable variant");
+    }
+    lua_pop(lua, lua_gettop(lua));
+    return 0;
+}
+
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+// Containers.
+
+static int32_t vectorHandwritten(lua_State* lua) {
+    luaL_checktype(lua, 1, LUA_TTABLE);
+    const lua_Unsigned length = lua_rawlen(lua, 1);
+    std::vector<int64_t> vector(static_cast<size_t>(length));
+    for (lua_Unsigned i = 0; i < length; ++i) {
+        lua_rawgeti(lua, 1, static_cast<lua_Integer>(i + 1));
+        if (!lua_isinteger(lua, -1)) {
+            return luaL_error(lua, "an integer expected");
+        }
+        vector[i] = lua_tointeger(lua, -1);
+        lua_pop(lua, 1);
+    }
+    lua_pop(lua, lua_gettop(lua));
+    return 0;
+}
+
+static int32_t stringMapHandwritten(lua_State* lua) {
+    luaL_checktype(lua, 1, LUA_TTABLE);
+    std::map<std::string, std::string> map;
+    lua_pushnil(lua);
+    while (lua_next(lua, 1) != 0) {
+        if (lua_type(lua, -2) != LUA_TSTRING || lua_type(lua, -1) != LUA_TSTRING) {
+            return luaL_error(lua, "a string expected");
+        }
+        size_t keyLen = 0;
+        const char* key = lua_tolstring(lua, -2, &keyLen);
+        size_t valueLen = 0;
+        const char* value = lua_tolstring(lua, -1, &valueLen);
+        map.emplace(std::string(key, keyLen), std::string(value, valueLen));
+        lua_pop(lua, 1);
+    }
+    lua_pop(lua, lua_gettop(lua));
+    return 0;
+}
+
+using NestedVariant = std::variant<int64_t, std::map<std::string, std::vector<double>>>;
+
+static int32_t nestedHandwritten(lua_State* lua) {
+    NestedVariant arg;
+    if (lua_isinteger(lua, 1)) {
+        arg = static_cast<int64_t>(lua_tointeger(lua, 1));
+        lua_pop(lua, lua_gettop(lua));
+        return 0;
+    }
+    luaL_checktype(lua, 1, LUA_TTABLE);
+    auto& map = arg.emplace<1>();
+    lua_pushnil(lua);
+    while (lua_next(lua, 1) != 0) {
+        if (lua_type(lua, -2) != LUA_TSTRING || lua_type(lua, -1) != LUA_TTABLE) {
+            return luaL_error(lua, "a table expected");
+        }
+        auto& vector = map[lua_tostring(lua, -2)];
+        const lua_Unsigned length = lua_rawlen(lua, -1);
+        vector.resize(static_cast<size_t>(length));
+        for (lua_Unsigned i = 0; i < length; ++i) {
+            lua_rawgeti(lua, -1, static_cast<lua_Integer>(i + 1));
+            if (lua_type(lua, -1) != LUA_TNUMBER || lua_isinteger(lua, -1)) {
+                return luaL_error(lua, "a number expected");
+            }
+            vector[i] = lua_tonumber(lua, -1);
+            lua_pop(lua, 1);
+        }
+        lua_pop(lua, 1);
+    }
+    lua_pop(lua, lua_gettop(lua));
+    return 0;
+}
+
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+// Container alternatives of a variant: the alternative is chosen by probing
+// the table before anything is built ("single-pass") versus the baseline
+// parser, which built every alternative in turn, staging the elements of
+// a vector in a std::map, until one succeeded ("retry").
+
+using VectorAlternatives = std::variant<std::vector<int64_t>, std::vector<double>>;
+using MapAlternatives = std::variant<
+    std::map<std::string, std::vector<int64_t>>,
+    std::map<std::string, std::vector<double>>
+>;
+
+template <typename variant_t>
+struct SinglePass {
+    static int32_t call(lua_State* lua) {
+        variant_t args;
+        std::string errorStr;
+        if (!lua::cArgParse(lua, args, errorStr)) {
+            return luaL_error(lua, errorStr.c_str());
+        }
+        if (args.index() != 1) {
+            return luaL_error(lua, "args.index() != 1");
+        }
+        return 0;
+    }
+};
+
+static bool readBaseline(lua_State* lua, const int32_t idx, int64_t& value) {
+    if (!lua_isinteger(lua, idx)) {
+        return false;
+    }
+    value = lua_tointeger(lua, idx);
+    return true;
+}
+static bool readBaseline(lua_State* lua, const int32_t idx, double& value) {
+    if (lua_type(lua, idx) != LUA_TNUMBER || lua_isinteger(lua, idx)) {
+        return false;
+    }
+    value = lua_tonumber(lua, idx);
+    return true;
+}
+template <typename T>
+static bool readBaseline(lua_State* lua, const int32_t idx, std::vector<T>& vector) {
+    if (lua_type(lua, idx) != LUA_TTABLE) {
+        return false;
+    }
+    const int32_t tableIdx = lua_absindex(lua, idx);
+    std::map<lua_Integer, T> staged;
+    lua_pushnil(lua);
+    while (lua_next(lua, tableIdx) != 0) {
+        T value {};
+        if (!lua_isinteger(lua, -2) || !readBaseline(lua, -1, value)) {
+            lua_pop(lua, 2);
+            return false;
+        }
+        staged.emplace(lua_tointeger(lua, -2), value);
+        lua_pop(lua, 1);
+    }
+    lua_Integer expected = 1;
+    for (const auto& [key, value] : staged) {
+        if (key != expected++) {
+            return false;
+        }
+        vector.push_back(value);
+    }
+    return true;
+}
+template <typename T>
+static bool readBaseline(lua_State* lua, const int32_t idx, std::map<std::string, T>& map) {
+    if (lua_type(lua, idx) != LUA_TTABLE) {
+        return false;
+    }
+    const int32_t tableIdx = lua_absindex(lua, idx);
+    lua_pushnil(lua);
+    while (lua_next(lua, tableIdx) != 0) {
+        T value {};
+        if (lua_type(lua, -2) != LUA_TSTRING || !readBaseline(lua, -1, value)) {
+            lua_pop(lua, 2);
+            return false;
+        }
+        map.emplace(lua_tostring(lua, -2), std::move(value));
+        lua_pop(lua, 1);
+    }
+    return true;
+}
+
+template <typename variant_t>
+struct Retry {
+    static int32_t call(lua_State* lua) {
+        variant_t args;
+        if (!readBaseline(lua, 1, args.template emplace<0>())
+                && !readBaseline(lua, 1, args.template emplace<1>())) {
+            return luaL_error(lua, "no suitable variant");
+        }
+        if (args.index() != 1) {
+            return luaL_error(lua, "args.index() != 1");
+        }
+        lua_pop(lua, lua_gettop(lua));
+        return 0;
+    }
+};
+
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+// Per-element cost of the numeric paths, into long-lived arguments.
+
+template <typename arg_t>
+struct Numbers {
+    static int32_t call(lua_State* lua) {
+        thread_local std::tuple<arg_t> args;
+        lua::LuaCArgParseError error;
+        if (!lua::cArgParse(lua, args, error)) {
+            return luaL_error(lua, error.toString().c_str());
+        }
+        return 0;
+    }
+};
+
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+// An options table of 20 fields: looked up by key into a record versus
+// collected into a map of variants.
+
+struct Options20 {
+    int64_t f1, f2, f3, f4, f5, f6, f7, f8, f9, f10;
+    int64_t f11, f12, f13, f14, f15, f16, f17, f18, f19, f20;
+    static constexpr auto luaFields() {
+        return std::make_tuple(
+            lua::LuaCArgParseField{ "f1", &Options20::f1 },
+            lua::LuaCArgParseField{ "f2", &Options20::f2 },
+            lua::LuaCArgParseField{ "f3", &Options20::f3 },
+            lua::LuaCArgParseField{ "f4", &Options20::f4 },
+            lua::LuaCArgParseField{ "f5", &Options20::f5 },
+            lua::LuaCArgParseField{ "f6", &Options20::f6 },
+            lua::LuaCArgParseField{ "f7", &Options20::f7 },
+            lua::LuaCArgParseField{ "f8", &Options20::f8 },
+            lua::LuaCArgParseField{ "f9", &Options20::f9 },
+            lua::LuaCArgParseField{ "f10", &Options20::f10 },
+            lua::LuaCArgParseField{ "f11", &Options20::f11 },
+            lua::LuaCArgParseField{ "f12", &Options20::f12 },
+            lua::LuaCArgParseField{ "f13", &Options20::f13 },
+            lua::LuaCArgParseField{ "f14", &Options20::f14 },
+            lua::LuaCArgParseField{ "f15", &Options20::f15 },
+            lua::LuaCArgParseField{ "f16", &Options20::f16 },
+            lua::LuaCArgParseField{ "f17", &Options20::f17 },
+            lua::LuaCArgParseField{ "f18", &Options20::f18 },
+            lua::LuaCArgParseField{ "f19", &Options20::f19 },
+            lua::LuaCArgParseField{ "f20", &Options20::f20 });
+    }
+};
+using OptionsMap = std::map<std::string, std::variant<int64_t, double, std::string>>;
+
+// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+// Rows of arguments: a call from a Lua loop per row versus one batch call.
+
+static double emittedSum = 0.0;
+
+static void emitRow(std::string_view id, double x, double y) {
+    emittedSum += static_cast<double>(id.size()) + x + y;
+}
+
+// Calls `emitLoop(rows)`, which calls the bound emitRow once per row.
+static int32_t rowsPerCall(lua_State* lua) {
+    lua_getglobal(lua, "emitLoop");
+    lua_insert(lua, 1);
+    lua_call(lua, 1, 0);
+    return 0;
+}
+
+int main() {
+    lua_State* lua = luaL_newstate();
+    luaL_openlibs(lua);
+    std::cout << "case,approach,ns_per_call,ns_per_element,allocs_per_call,bytes_per_call"
+        << std::endl;
+
+    lua_register(lua, "emit", lua::cArgBind<&emitRow>());
+    if (luaL_dostring(lua,
+            "integer = 123"
+            " number = 0.5"
+            " str = \"a string longer than the small string buffer\""
+            " vector1k = { }"
+            " for i = 1, 1000 do vector1k[i] = i end"
+            " integerVector100k = { }"
+            " for i = 1, 100000 do integerVector100k[i] = i end"
+            " stringMap1k = { }"
+            " for i = 1, 1000 do stringMap1k[\"key\" .. i] = \"value\" .. i end"
+            " nested = { }"
+            " for i = 1, 100 do"
+            "   nested[\"key\" .. i] = { }"
+            "   for j = 1, 10 do nested[\"key\" .. i][j] = j + 0.5 end"
+            " end"
+            " vector100k = { }"
+            " for i = 1, 100000 do vector100k[i] = i + 0.5 end"
+            " map100k = { }"
+            " for i = 1, 100000 do map100k[\"key\" .. i] = { i + 0.5, 0.5 } end"
+            " integers100k = { }"
+            " for i = 1, 100000 do integers100k[i] = i % 30000 end"
+            " numbers100k = { }"
+            " for i = 1, 100000 do numbers100k[\"key\" .. i] = i + 0.5 end"
+            " options20 = { }"
+            " for i = 1, 20 do options20[\"f\" .. i] = i end"
+            " rows1k = { }"
+            " for i = 1, 1000 do rows1k[i] = { \"id\" .. i, i + 0.5, 0.5 } end"
+            " function emitLoop(rows)"
+            "   for i = 1, #rows do local row = rows[i] emit(row[1], row[2], row[3]) end"
+            " end") != LUA_OK) {
+        std::cerr << lua_tostring(lua, -1) << std::endl;
+        return 1;
+    }
+
+    compare(lua, "scalar_tuple", "integer number str", 1000000, 3, {
+        { "cArgParse", Parse<int32_t, double, std::string>::call },
+        { "handwritten", scalarsHandwritten } });
+    compare(lua, "optional_tail", "integer", 1000000, 1, {
+        { "cArgParse", Parse<int32_t, std::optional<int32_t>, std::optional<std::string>>::call },
+        { "handwritten", optionalsHandwritten } });
+    compare(lua, "wide_variant", "str", 1000000, 1, {
+        { "cArgParse", Parse<WideVariant>::call },
+        { "handwritten", wideVariantHandwritten } });
+    compare(lua, "vector_1k", "vector1k", 10000, 1000, {
+        { "cArgParse", Parse<std::vector<int64_t>>::call },
+        { "handwritten", vectorHandwritten } });
+    compare(lua, "vector_100k", "integerVector100k", 100, 100000, {
+        { "cArgParse", Parse<std::vector<int64_t>>::call },
+        { "handwritten", vectorHandwritten } });
+    compare(lua, "string_map_1k", "stringMap1k", 1000, 1000, {
+        { "cArgParse", Parse<std::map<std::string, std::string>>::call },
+        { "handwritten", stringMapHandwritten } });
+    compare(lua, "nested_vector_in_map_in_variant", "nested", 10000, 1000, {
+        { "cArgParse", Parse<NestedVariant>::call },
+        { "handwritten", nestedHandwritten } });
+
+    compare(lua, "variant_vector_100k", "vector100k", 100, 100000, {
+        { "single-pass", SinglePass<VectorAlternatives>::call },
+        { "retry", Retry<VectorAlternatives>::call } });
+    compare(lua, "variant_map_100k", "map100k", 10, 100000, {
+        { "single-pass", SinglePass<MapAlternatives>::call },
+        { "retry", Retry<MapAlternatives>::call } });
+
+    compare(lua, "int16_vector_100k", "integers100k", 100, 100000, {
+        { "cArgParse", Numbers<std::vector<int16_t>>::call } });
+    compare(lua, "float_vector_100k", "vector100k", 100, 100000, {
+        { "cArgParse", Numbers<std::vector<float>>::call } });
+    compare(lua, "double_map_100k", "numbers100k", 20, 100000, {
+        { "cArgParse", Numbers<std::unordered_map<std::string, double>>::call } });
+
+    compare(lua, "options_20_fields", "options20", 100000, 20, {
+        { "record", Numbers<Options20>::call },
+        { "map_of_variants", Numbers<OptionsMap>::call } });
+
+    compare(lua, "rows_1k", "rows1k", 1000, 1000, {
+        { "call_per_row", rowsPerCall },
+        { "batch", lua::cArgBindBatch<&emitRow>() } });
+
+    lua_close(lua);
+    return 0;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Counts the C++ heap allocations, Lua allocates through its own lua_Alloc.
+// Every form of operator new and operator delete is replaced, so the sized,
+// aligned and array ones match. Atomic, as the snapshots are built on several
+// threads. Include it in one translation unit of a test executable.
+
+static std::atomic<size_t> allocationsCount = 0;
+static std::atomic<size_t> deallocationsCount = 0;
+static std::atomic<size_t> allocatedBytes = 0;
+
+static void* countedAlloc(const size_t size, const size_t alignment) {
+    allocationsCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    const size_t bytes = size == 0 ? 1 : size;
+    if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        return std::malloc(bytes);
+    }
+#ifdef _MSC_VER
+    return _aligned_malloc(bytes, alignment);
+#else
+    // aligned_alloc wants a multiple of the alignment.
+    return std::aligned_alloc(alignment, (bytes + alignment - 1) / alignment * alignment);
+#endif
+}
+
+static void countedFree(void* ptr, const size_t alignment) {
+    if (ptr == nullptr) {
+        return;
+    }
+    deallocationsCount.fetch_add(1, std::memory_order_relaxed);
+#ifdef _MSC_VER
+    if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+        _aligned_free(ptr);
+        return;
+    }
+#else
+    (void)alignment;
+#endif
+    std::free(ptr);
+}
+
+static void* countedNew(const size_t size, const size_t alignment) {
+    if (void* ptr = countedAlloc(size, alignment)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size) {
+    return countedNew(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void* operator new[](size_t size) {
+    return countedNew(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+    return countedNew(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return countedNew(size, static_cast<size_t>(alignment));
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return countedAlloc(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAlloc(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return countedAlloc(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept {
+    countedFree(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void operator delete[](void* ptr) noexcept {
+    countedFree(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void operator delete(void* ptr, size_t) noexcept {
+    countedFree(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void operator delete[](void* ptr, size_t) noexcept {
+    countedFree(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void operator delete(void* ptr, std::align_val_t alignment) noexcept {
+    countedFree(ptr, static_cast<size_t>(alignment));
+}
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept {
+    countedFree(ptr, static_cast<size_t>(alignment));
+}
+void operator delete(void* ptr, size_t, std::align_val_t alignment) noexcept {
+    countedFree(ptr, static_cast<size_t>(alignment));
+}
+void operator delete[](void* ptr, size_t, std::align_val_t alignment) noexcept {
+    countedFree(ptr, static_cast<size_t>(alignment));
+}
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    countedFree(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    countedFree(ptr, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void operator delete(void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    countedFree(ptr, static_cast<size_t>(alignment));
+}
+void operator delete[](void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    countedFree(ptr, static_cast<size_t>(alignment));
+}
@@ -1,5 +1,10 @@
 #include <iostream>
 #include <cassert>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <functional>
 
 #ifdef _MSC_VER
 #   pragma comment(lib, "lua.lib")
@@ -11,6 +16,7 @@
 //}
 
 #include "../lua_cArgParse.hpp"
+#include "counting_allocator.hpp"
 
 //static void dumpstack(lua_State* L) {
 //    printf("//==--\n");
@@ -46,6 +52,46 @@ bool contains(const std::string_view source, const std::string_view pattern) {
     return true;
 }
 
+// Functions bound with cArgBind need linkage.
+struct TestBind {
+    static int64_t add(int32_t a, std::optional<int32_t> b) {
+        return a + b.value_or(0);
+    }
+    static std::tuple<size_t, std::string> join(const std::vector<std::string>& strs,
+            std::string_view separator) {
+        std::string str;
+        for (const auto& it : strs) {
+            str += (str.empty() ? "" : std::string(separator)) + it;
+        }
+        return { strs.size(), str };
+    }
+    static void top(lua_State* lua, const std::string& name) {
+        lua_pushinteger(lua, lua_gettop(lua));
+        lua_setglobal(lua, name.c_str());
+    }
+    static void emit(lua_State* lua, std::string_view id, double x, std::optional<double> y) {
+        lua_getglobal(lua, "emitted");
+        const std::string line = std::string(id) + ":" + std::to_string(x + y.value_or(0.0));
+        lua_pushfstring(lua, "%s%s;", lua_tostring(lua, -1), line.c_str());
+        lua_setglobal(lua, "emitted");
+        lua_pop(lua, 1);
+    }
+    static size_t count(lua_State* lua, const std::vector<int32_t>& values) {
+        if (values.empty()) {
+            luaL_error(lua, "no values");
+        }
+        return values.size();
+    }
+    static int64_t dot(const std::vector<int64_t>& a, const std::vector<int64_t>& b,
+            std::optional<int64_t> bias) {
+        int64_t result = bias.value_or(0);
+        for (size_t i = 0; i < a.size() && i < b.size(); ++i) {
+            result += a[i] * b[i];
+        }
+        return result;
+    }
+};
+
 int main() {
     lua_State* lua = luaL_newstate();
     using namespace utils;
@@ -459,6 +505,43 @@ int main() {
 
     // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
+    struct TestVectorNotOnTop {
+        static int32_t test(lua_State* lua) {
+            std::tuple<std::vector<int32_t>, int32_t> args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            const auto& vec = std::get<0>(args);
+            if (vec.size() != static_cast<size_t>(std::get<1>(args))) {
+                luaL_error(lua, "vec.size() != arg 2");
+                return 0;
+            }
+            for (size_t i = 0; i < vec.size(); ++i) {
+                if (vec[i] != static_cast<int32_t>(i + 1) * 10) {
+                    luaL_error(lua, "vec[i] != (i + 1) * 10");
+                    return 0;
+                }
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestVectorNotOnTop::test);
+    assert(luaL_dostring(lua, "test({ 10, 20, 30 }, 3)") == LUA_OK);
+    assert(luaL_dostring(lua, "test({ }, 0)") == LUA_OK);
+    assert(luaL_dostring(lua, "local t = { } for i = 1, 1000 do t[i] = i * 10 end"
+        " test(t, 1000)") == LUA_OK);
+    assert(luaL_dostring(lua, "test({ [3] = 30, [1] = 10, [2] = 20 }, 3)") == LUA_OK);
+
+    assert(luaL_dostring(lua, "test({ 10, 20, nil, 40 }, 4)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "wrong key sequence in table at arg 1"));
+
+    assert(luaL_dostring(lua, "test({ 10, 20, x = 30 }, 3)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "an integer key expected in table at arg 1"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
     struct TestVectorInVariant {
         static int32_t test(lua_State* lua) {
             std::variant<
@@ -706,6 +789,1204 @@ int main() {
 
     // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
 
+    struct TestStringViews {
+        static int32_t test(lua_State* lua) {
+            std::tuple<
+                std::string_view,
+                std::map<std::string_view, std::vector<std::string_view>>,
+                std::optional<const char*>
+            > args;
+            std::string errorStr;
+            lua::LuaCArgParseOptions options;
+            options.keepArgs = true;
+            if (!lua::cArgParse(lua, args, errorStr, options)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            if (lua_gettop(lua) < 2) {
+                luaL_error(lua, "arguments were popped");
+                return 0;
+            }
+            const auto& arg1 = std::get<0>(args);
+            if (arg1 != "str" || arg1.data() != lua_tostring(lua, 1)) {
+                luaL_error(lua, "arg1 is not a view of \"str\"");
+                return 0;
+            }
+            const auto& arg2 = std::get<1>(args);
+            const auto it = arg2.find("key");
+            if (arg2.size() != 1 || it == arg2.end()
+                    || it->second != std::vector<std::string_view>({ "a", "bc" })) {
+                luaL_error(lua, "arg2 != { key = { \"a\", \"bc\" } }");
+                return 0;
+            }
+            const auto& arg3 = std::get<2>(args);
+            if (arg3 && (std::string_view(*arg3) != "zero-terminated"
+                    || *arg3 != lua_tostring(lua, 3))) {
+                luaL_error(lua, "arg3 is not a view of \"zero-terminated\"");
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestStringViews::test);
+    assert(luaL_dostring(lua, "test(\"str\", { key = { \"a\", \"bc\" } })") == LUA_OK);
+    assert(luaL_dostring(lua, "test(\"str\", { key = { \"a\", \"bc\" } },"
+        " \"zero-terminated\")") == LUA_OK);
+
+    assert(luaL_dostring(lua, "test(\"str\", { key = { \"a\", 1 } })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "a string expected at arg -1"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestErrorRecord {
+        static int32_t test(lua_State* lua) {
+            std::tuple<int32_t, std::map<std::string, std::vector<int16_t>>> args;
+            lua::LuaCArgParseError error;
+            if (!lua::cArgParse(lua, args, error)) {
+                if (error.code != lua::LuaCArgParseError::Code::OutOfRange
+                        || error.integer != 100000 || error.depth != 2
+                        || error.rootArgIdx != 2
+                        || std::string_view(error.expected) != "int16_t") {
+                    luaL_error(lua, "unexpected error record");
+                    return 0;
+                }
+                luaL_error(lua, error.toString().c_str());
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestErrorRecord::test);
+    assert(luaL_dostring(lua, "test(1, { key = { 1, 2, 3 } })") == LUA_OK);
+
+    assert(luaL_dostring(lua, "test(1, { key = { 1, 2, 100000 } })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)),
+        "value 100000 at arg -1 is out of int16_t range in arg 2[\"key\"][3]"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestWideVariant {
+        static int32_t test(lua_State* lua) {
+            std::tuple<std::variant<
+                std::nullptr_t, double, int8_t, int16_t, int32_t, int64_t,
+                std::string, std::vector<int32_t>
+            >, size_t> args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            if (std::get<0>(args).index() != std::get<1>(args)) {
+                luaL_error(lua, "unexpected alternative %d",
+                    static_cast<int32_t>(std::get<0>(args).index()));
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestWideVariant::test);
+    assert(luaL_dostring(lua, "test(1.5, 1)") == LUA_OK);
+    assert(luaL_dostring(lua, "test(100, 2)") == LUA_OK);
+    assert(luaL_dostring(lua, "test(1000, 3)") == LUA_OK);
+    assert(luaL_dostring(lua, "test(100000, 4)") == LUA_OK);
+    assert(luaL_dostring(lua, "test(10000000000, 5)") == LUA_OK);
+    assert(luaL_dostring(lua, "test(\"str\", 6)") == LUA_OK);
+    assert(luaL_dostring(lua, "test({ 1, 2 }, 7)") == LUA_OK);
+
+    assert(luaL_dostring(lua, "test(true, 0)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "no suitable variant"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestVariantOfVariantVectors {
+        static int32_t test(lua_State* lua) {
+            std::tuple<std::variant<
+                std::vector<std::variant<int32_t, std::string>>,
+                std::vector<double>,
+                std::map<std::string, std::vector<int8_t>>,
+                std::map<std::string, std::vector<int64_t>>
+            >, size_t> args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            if (std::get<0>(args).index() != std::get<1>(args)) {
+                luaL_error(lua, "unexpected alternative %d",
+                    static_cast<int32_t>(std::get<0>(args).index()));
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestVariantOfVariantVectors::test);
+    assert(luaL_dostring(lua, "test({ 1, \"str\" }, 0)") == LUA_OK);
+    assert(luaL_dostring(lua, "test({ 1.5, 2.5 }, 1)") == LUA_OK);
+    assert(luaL_dostring(lua, "test({ key = { 1, 2 } }, 2)") == LUA_OK);
+    assert(luaL_dostring(lua, "test({ key = { 1000, 1 } }, 3)") == LUA_OK);
+
+    assert(luaL_dostring(lua, "test({ 1.5, 2 }, 1)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "a number expected at arg -1 in arg 1[2]"));
+
+    // The first entry fits std::vector<int8_t>, the whole table fits only
+    // the next alternative.
+    assert(luaL_dostring(lua, "test({ key = { 1, 1000 } }, 3)") == LUA_OK);
+    assert(luaL_dostring(lua, "test({ key = { 1, 1000, 2.5 } }, 3)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "is out of int8_t range"));
+
+    assert(luaL_dostring(lua, "test({ key = \"str\" }, 2)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "no suitable variant"));
+
+    struct TestVariantFallback {
+        static int32_t test(lua_State* lua) {
+            std::tuple<std::variant<std::vector<int32_t>, std::vector<int64_t>>> args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            const auto& variant = std::get<0>(args);
+            lua_pushinteger(lua, static_cast<lua_Integer>(variant.index()));
+            lua_pushinteger(lua, variant.index() == 1 ? std::get<1>(variant).back() : 0);
+            return 2;
+        }
+    };
+    lua_register(lua, "test", TestVariantFallback::test);
+    assert(luaL_dostring(lua, "return test({ 1, 10000000000 })") == LUA_OK);
+    assert(lua_tointeger(lua, -2) == 1 && lua_tointeger(lua, -1) == 10000000000);
+    lua_pop(lua, 2);
+    assert(luaL_dostring(lua, "return test({ 1, 2 })") == LUA_OK);
+    assert(lua_tointeger(lua, -2) == 0);
+    lua_pop(lua, 2);
+    assert(luaL_dostring(lua, "test({ 1, 10000000000, \"str\" })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "is out of int32_t range in arg 1[2]"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestReuseStorage {
+        using Args = std::tuple<
+            std::vector<std::string>,
+            std::map<std::string, std::vector<double>>,
+            std::variant<std::vector<int32_t>, std::string>,
+            std::optional<std::string>
+        >;
+        static Args& args() {
+            static Args args;
+            return args;
+        }
+        static size_t& allocations() {
+            static size_t allocations = 0;
+            return allocations;
+        }
+        static int32_t test(lua_State* lua) {
+            lua::LuaCArgParseError error;
+            const size_t allocationsBefore = allocationsCount;
+            const bool ok = lua::cArgParse(lua, args(), error);
+            allocations() = allocationsCount - allocationsBefore;
+            if (!ok) {
+                luaL_error(lua, error.toString().c_str());
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestReuseStorage::test);
+    const char* reuseCall = "test("
+        "{ \"a string that does not fit into SSO\", \"another long enough string\" },"
+        " { first_key_of_the_map = { 1.5, 2.5, 3.5 }, second = { 4.5 } },"
+        " { 1, 2, 3, 4, 5, 6, 7, 8 },"
+        " \"an optional string that is long enough\")";
+    assert(luaL_dostring(lua, reuseCall) == LUA_OK);
+    assert(TestReuseStorage::allocations() != 0);
+    assert(luaL_dostring(lua, reuseCall) == LUA_OK);
+    assert(TestReuseStorage::allocations() == 0);
+    assert(luaL_dostring(lua, reuseCall) == LUA_OK);
+    assert(TestReuseStorage::allocations() == 0);
+    {
+        const auto& args = TestReuseStorage::args();
+        assert(std::get<0>(args).size() == 2);
+        assert(std::get<0>(args)[1] == "another long enough string");
+        assert(std::get<1>(args).size() == 2);
+        assert(std::get<1>(args).at("first_key_of_the_map")
+            == std::vector<double>({ 1.5, 2.5, 3.5 }));
+        assert(std::get<2>(args).index() == 0);
+        assert(std::get<3>(args) == "an optional string that is long enough");
+    }
+    // Fewer elements and keys fit into the existing storage.
+    assert(luaL_dostring(lua, "test({ \"short\" }, { second = { 0.5 } }, { 1 })") == LUA_OK);
+    assert(TestReuseStorage::allocations() == 0);
+    {
+        const auto& args = TestReuseStorage::args();
+        assert(std::get<0>(args) == std::vector<std::string>({ "short" }));
+        assert(std::get<1>(args).size() == 1);
+        assert(std::get<1>(args).at("second") == std::vector<double>({ 0.5 }));
+        assert(std::get<2>(args) == (std::variant<std::vector<int32_t>, std::string>(
+            std::vector<int32_t>({ 1 }))));
+        assert(!std::get<3>(args).has_value());
+    }
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestMemoryResource {
+        static int32_t test(lua_State* lua) {
+            // Everything goes to the arena, the heap is never touched.
+            alignas(std::max_align_t) static char buffer[16 * 1024];
+            std::pmr::monotonic_buffer_resource arena(
+                buffer, sizeof(buffer), std::pmr::null_memory_resource());
+            lua::LuaCArgParseOptions options;
+            options.memoryResource = &arena;
+            lua::LuaCArgParseError error;
+            const size_t allocationsBefore = allocationsCount;
+            std::tuple<
+                std::pmr::vector<std::pmr::string>,
+                std::pmr::map<std::pmr::string, std::variant<int32_t, std::pmr::vector<double>>>,
+                std::variant<std::pmr::string, int32_t>,
+                std::optional<std::pmr::string>
+            > args(std::allocator_arg, std::pmr::polymorphic_allocator<std::byte>(&arena));
+            lua::cArgParse(lua, args, error, options);
+            if (allocationsCount != allocationsBefore) {
+                luaL_error(lua, "the heap was used");
+                return 0;
+            }
+            if (!error.empty()) {
+                luaL_error(lua, error.toString().c_str());
+                return 0;
+            }
+            const auto& arg1 = std::get<0>(args);
+            if (arg1.size() != 2 || arg1[1] != "another long enough string"
+                    || arg1.get_allocator().resource() != &arena
+                    || arg1[1].get_allocator().resource() != &arena) {
+                luaL_error(lua, "unexpected arg1");
+                return 0;
+            }
+            const auto& arg2 = std::get<1>(args);
+            const auto it = arg2.find("first_key_of_the_map");
+            if (arg2.size() != 2 || it == arg2.end() || it->second.index() != 1
+                    || std::get<1>(it->second).size() != 3
+                    || std::get<1>(it->second).get_allocator().resource() != &arena) {
+                luaL_error(lua, "unexpected arg2");
+                return 0;
+            }
+            const auto& arg3 = std::get<2>(args);
+            if (arg3.index() != 0
+                    || std::get<0>(arg3).get_allocator().resource() != &arena) {
+                luaL_error(lua, "unexpected arg3");
+                return 0;
+            }
+            const auto& arg4 = std::get<3>(args);
+            if (!arg4 || arg4->get_allocator().resource() != &arena) {
+                luaL_error(lua, "unexpected arg4");
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestMemoryResource::test);
+    assert(luaL_dostring(lua, "test("
+        "{ \"a string that does not fit into SSO\", \"another long enough string\" },"
+        " { first_key_of_the_map = { 1.5, 2.5, 3.5 }, second_key_of_the_map = 1 },"
+        " \"a variant string that is long enough\","
+        " \"an optional string that is long enough\")") == LUA_OK);
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestHashAndFlatMaps {
+        static int32_t test(lua_State* lua) {
+            std::tuple<
+                std::unordered_map<std::string, std::vector<int32_t>>,
+                std::vector<std::pair<int32_t, std::string>>,
+                std::variant<std::vector<int32_t>, std::vector<std::pair<std::string, double>>>
+            > args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            const auto& arg1 = std::get<0>(args);
+            const auto it = arg1.find("b");
+            if (arg1.size() != 2 || it == arg1.end()
+                    || it->second != std::vector<int32_t>({ 3, 4 })
+                    || arg1.bucket_count() < 2) {
+                luaL_error(lua, "arg1 != { a = { 1, 2 }, b = { 3, 4 } }");
+                return 0;
+            }
+            const auto& arg2 = std::get<1>(args);
+            if (arg2 != std::vector<std::pair<int32_t, std::string>>({
+                    { -5, "m" }, { 1, "a" }, { 3, "c" }, { 20, "z" } })) {
+                luaL_error(lua, "arg2 is not sorted by key");
+                return 0;
+            }
+            const auto& arg3 = std::get<2>(args);
+            if (arg3.index() != 1 || std::get<1>(arg3).size() != 2
+                    || std::get<1>(arg3)[0].first != "x") {
+                luaL_error(lua, "arg3 != { y = 2.5, x = 1.5 }");
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestHashAndFlatMaps::test);
+    assert(luaL_dostring(lua, "test({ a = { 1, 2 }, b = { 3, 4 } },"
+        " { [20] = \"z\", [1] = \"a\", [-5] = \"m\", [3] = \"c\" },"
+        " { y = 2.5, x = 1.5 })") == LUA_OK);
+
+    assert(luaL_dostring(lua, "test({ a = { 1, 2 }, b = { 3, 4 } },"
+        " { [20] = \"z\", [1] = 1 }, { })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "a string expected at arg -1 in arg 2[1]"));
+
+    assert(luaL_dostring(lua, "test({ a = { 1, 2 }, b = { 3, 4.5 } }, { }, { })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "an integer expected at arg -1 in arg 1[\"b\"][2]"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestNarrowVectors {
+        static int32_t test(lua_State* lua) {
+            std::tuple<std::vector<int16_t>, std::vector<float>> args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            const auto& arg1 = std::get<0>(args);
+            for (size_t i = 0; i < arg1.size(); ++i) {
+                if (arg1[i] != static_cast<int16_t>(i % 1000 - 500)) {
+                    luaL_error(lua, "arg1[%d] != %d", static_cast<int32_t>(i),
+                        static_cast<int32_t>(i % 1000 - 500));
+                    return 0;
+                }
+            }
+            if (std::get<1>(args) != std::vector<float>({ 0.5f, -1.5f })) {
+                luaL_error(lua, "arg2 != { 0.5, -1.5 }");
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestNarrowVectors::test);
+    assert(luaL_dostring(lua, "local v = { }"
+        " for i = 1, 3000 do v[i] = (i - 1) % 1000 - 500 end"
+        " test(v, { 0.5, -1.5 })") == LUA_OK);
+
+    // The first of the failed elements is reported, wherever the blocks end.
+    assert(luaL_dostring(lua, "local v = { }"
+        " for i = 1, 3000 do v[i] = 0 end"
+        " v[257] = 40000 v[258] = -40000 v[900] = \"str\""
+        " test(v, { })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)),
+        "value 40000 at arg -1 is out of int16_t range in arg 1[257]"));
+
+    // Staged and then flushed by a type error in the same block.
+    assert(luaL_dostring(lua, "test({ 1, 2, 100000, \"x\" }, { })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)),
+        "value 100000 at arg -1 is out of int16_t range in arg 1[3]"));
+
+    assert(luaL_dostring(lua, "local v = { }"
+        " for i = 1, 3000 do v[i] = 0 end"
+        " v[100] = 1.5 v[200] = 40000"
+        " test(v, { })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "an integer expected at arg -1 in arg 1[100]"));
+
+    assert(luaL_dostring(lua, "local v = { }"
+        " for i = 1, 300 do v[i] = 0 end"
+        " v[250] = 40000 v[301] = 0 v[303] = 0"
+        " test(v, { })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "is out of int16_t range in arg 1[250]"));
+
+    // A border of 2^40 + 1 with 42 entries is not a size, the elements are
+    // still checked.
+    const char* sparse = "local function sparse(e, value)"
+        " local t = { } t[2^e + 1] = value"
+        " for i = e, 0, -1 do t[1 << i] = value end"
+        " return t end ";
+    assert(luaL_dostring(lua, (std::string(sparse) +
+        "test(sparse(40, 0), { })").c_str()) != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "wrong key sequence in table at arg 1"));
+
+    assert(luaL_dostring(lua, (std::string(sparse) +
+        "local v = sparse(40, 0) v[4096] = 40000 test(v, { })").c_str()) != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "is out of int16_t range in arg 1[4096]"));
+
+    assert(luaL_dostring(lua, "test({ 1, 2 }, { 0.5, 1e300 })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "is out of float range in arg 2[2]"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestMatrix {
+        static int32_t test(lua_State* lua) {
+            std::tuple<
+                lua::LuaCArgParseMatrix<double>,
+                std::map<std::string, lua::LuaCArgParseMatrix<int8_t>>
+            > args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            const auto& arg1 = std::get<0>(args);
+            if (arg1.rows != 2 || arg1.cols != 3
+                    || arg1.data != std::vector<double>({ 1.5, 2.5, 3.5, 4.5, 5.5, 6.5 })
+                    || arg1(1, 0) != 4.5) {
+                luaL_error(lua, "arg1 != { { 1.5, 2.5, 3.5 }, { 4.5, 5.5, 6.5 } }");
+                return 0;
+            }
+            const auto& arg2 = std::get<1>(args);
+            const auto it = arg2.find("m");
+            if (it == arg2.end() || it->second.rows != 3 || it->second.cols != 1
+                    || it->second(2, 0) != 3) {
+                luaL_error(lua, "arg2 != { m = { { 1 }, { 2 }, { 3 } } }");
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestMatrix::test);
+    assert(luaL_dostring(lua, "test({ { 1.5, 2.5, 3.5 }, { 4.5, 5.5, 6.5 } },"
+        " { m = { { 1 }, { 2 }, { 3 } }, empty = { } })") == LUA_OK);
+
+    assert(luaL_dostring(lua, "test({ { 1.5, 2.5, 3.5 }, { 4.5, 5.5 } }, { })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "wrong row length in table at arg -1 in arg 1[2]"));
+
+    // Borders of 2^40 + 1 and 2^62 with a few dozen entries are not sizes.
+    assert(luaL_dostring(lua, (std::string(sparse) +
+        "test({ sparse(40, 1.5), sparse(40, 1.5) }, { })").c_str()) != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "wrong key sequence in table at arg -1 in arg 1[1]"));
+
+    assert(luaL_dostring(lua, (std::string(sparse) +
+        "local s = sparse(62, 1.5) test({ s, s, s, s, s }, { })").c_str()) != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "wrong row length in table at arg -1 in arg 1[1]"));
+
+    assert(luaL_dostring(lua, (std::string(sparse) +
+        "local m = sparse(40, { 1.5 }) test(m, { })").c_str()) != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "wrong key sequence in table at arg 1"));
+
+    assert(luaL_dostring(lua, "test({ { 1.5 }, 2.5 }, { })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "a table expected at arg -1 in arg 1[2]"));
+
+    assert(luaL_dostring(lua, "test({ { 1.5 } }, { m = { { 1 }, { 1000 } } })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)),
+        "value 1000 at arg -1 is out of int8_t range in arg 2[\"m\"][2][1]"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestColumns {
+        struct Points {
+            std::vector<double> x;
+            std::vector<double> y;
+            std::vector<std::string> id;
+            static constexpr auto luaFields() {
+                return std::make_tuple(
+                    lua::LuaCArgParseField{ "x", &Points::x },
+                    lua::LuaCArgParseField{ "y", &Points::y },
+                    lua::LuaCArgParseField{ "id", &Points::id });
+            }
+        };
+        static int32_t test(lua_State* lua) {
+            std::tuple<lua::LuaCArgParseColumns<Points>> args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            const auto& points = std::get<0>(args);
+            if (points.x != std::vector<double>({ 1.5, 3.5 })
+                    || points.y != std::vector<double>({ 2.5, 4.5 })
+                    || points.id != std::vector<std::string>({ "a", "b" })) {
+                luaL_error(lua, "unexpected columns");
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestColumns::test);
+    assert(luaL_dostring(lua, "test({ { x = 1.5, y = 2.5, id = \"a\" },"
+        " { x = 3.5, y = 4.5, id = \"b\", extra = true } })") == LUA_OK);
+
+    assert(luaL_dostring(lua, "test({ { x = 1.5, y = 2.5, id = \"a\" },"
+        " { x = 3.5, id = \"b\" } })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "a number expected at arg -1 in arg 1[2][\"y\"]"));
+
+    assert(luaL_dostring(lua, "test({ { x = 1.5, y = 2.5, id = \"a\" }, 1 })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "a table expected at arg -1 in arg 1[2]"));
+
+    assert(luaL_dostring(lua, (std::string(sparse) +
+        "local c = sparse(40, { x = 1.5, y = 2.5, id = \"a\" })"
+        " c[4096] = { x = 1.5, id = \"b\" } test(c)").c_str()) != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)),
+        "a number expected at arg -1 in arg 1[4096][\"y\"]"));
+
+    assert(luaL_dostring(lua, (std::string(sparse) +
+        "test(sparse(40, { x = 1.5, y = 2.5, id = \"a\" }))").c_str()) != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "wrong key sequence in table at arg 1"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestRecord {
+        struct Size {
+            int32_t width = 0;
+            int32_t height = 0;
+            static constexpr auto luaFields() {
+                return std::make_tuple(
+                    lua::LuaCArgParseField{ "width", &Size::width },
+                    lua::LuaCArgParseField{ "height", &Size::height });
+            }
+        };
+        struct Options {
+            std::string title;
+            Size size;
+            std::optional<float> scale;
+            std::vector<std::string> tags;
+            static constexpr auto luaFields() {
+                return std::make_tuple(
+                    lua::LuaCArgParseField{ "title", &Options::title },
+                    lua::LuaCArgParseField{ "size", &Options::size },
+                    lua::LuaCArgParseField{ "scale", &Options::scale },
+                    lua::LuaCArgParseField{ "tags", &Options::tags });
+            }
+        };
+        static int32_t test(lua_State* lua) {
+            std::tuple<int32_t, Options> args;
+            lua::LuaCArgParseOptions options;
+            options.skipMissingFields = lua_toboolean(lua, 1) == 0;
+            options.rejectExtraFields = lua_toboolean(lua, 1) != 0;
+            lua_remove(lua, 1);
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr, options)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            const Options& opts = std::get<1>(args);
+            if (std::get<0>(args) == 1 && (opts.title != "main" || opts.size.width != 640
+                    || opts.size.height != 480 || opts.scale != 0.5f
+                    || opts.tags != std::vector<std::string>({ "a", "b" }))) {
+                luaL_error(lua, "unexpected record");
+                return 0;
+            }
+            if (std::get<0>(args) == 2 && (opts.title != "" || opts.size.width != 0
+                    || opts.scale.has_value() || !opts.tags.empty())) {
+                luaL_error(lua, "unexpected skipped fields");
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestRecord::test);
+    assert(luaL_dostring(lua, "test(true, 1, { title = \"main\", scale = 0.5,"
+        " size = { width = 640, height = 480 }, tags = { \"a\", \"b\" } })") == LUA_OK);
+    assert(luaL_dostring(lua, "test(false, 2, { size = { } })") == LUA_OK);
+
+    assert(luaL_dostring(lua, "test(true, 3, { title = \"main\","
+        " size = { width = 640 }, tags = { } })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)),
+        "an integer expected at arg -1 in arg 2[\"size\"][\"height\"]"));
+
+    assert(luaL_dostring(lua, "test(true, 3, { title = \"main\", colour = 1,"
+        " size = { width = 640, height = 480 }, tags = { } })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)),
+        "unknown field in table at arg 2 in arg 2[\"colour\"]"));
+
+    assert(luaL_dostring(lua, "test(false, 3, { title = \"main\", colour = 1,"
+        " size = { width = 640, height = 480 }, tags = { } })") == LUA_OK);
+
+    struct TestRecycledRecords {
+        // Long-lived, the nodes and the elements of the maps are reused.
+        static int32_t rec(lua_State* lua) {
+            static std::tuple<std::map<std::string, TestRecord::Size>> args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr, options())) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            return push(lua, std::get<0>(args).begin()->second);
+        }
+        static int32_t recFlat(lua_State* lua) {
+            static std::tuple<std::vector<std::pair<std::string, TestRecord::Size>>> args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr, options())) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            return push(lua, std::get<0>(args).begin()->second);
+        }
+        static lua::LuaCArgParseOptions options() {
+            lua::LuaCArgParseOptions options;
+            options.skipMissingFields = true;
+            return options;
+        }
+        static int32_t push(lua_State* lua, const TestRecord::Size& size) {
+            lua_pushinteger(lua, size.width);
+            lua_pushinteger(lua, size.height);
+            return 2;
+        }
+    };
+    lua_register(lua, "rec", TestRecycledRecords::rec);
+    lua_register(lua, "rec_flat", TestRecycledRecords::recFlat);
+    for (const char* rec : { "rec", "rec_flat" }) {
+        // A skipped field of b does not keep the value of a.
+        assert(luaL_dostring(lua, (std::string(rec) + "({ a = { width = 640, height = 480 } })"
+            " return " + rec + "({ b = { } })").c_str()) == LUA_OK);
+        assert(lua_tointeger(lua, -2) == 0 && lua_tointeger(lua, -1) == 0);
+        lua_pop(lua, 2);
+    }
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestEarlyReject {
+        static int32_t test(lua_State* lua) {
+            // A wrong call is rejected before arg 1 is built.
+            lua::LuaCArgParseError error;
+            const size_t allocationsBefore = allocationsCount;
+            std::tuple<std::vector<std::string>, int32_t, std::optional<std::string>> args;
+            lua::cArgParse(lua, args, error);
+            if (allocationsCount != allocationsBefore) {
+                luaL_error(lua, "arg 1 was built");
+                return 0;
+            }
+            if (!error.empty()) {
+                luaL_error(lua, error.toString().c_str());
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestEarlyReject::test);
+    assert(luaL_dostring(lua, "test({ \"a long enough string to be allocated\" }, 1, 2)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "a string expected at arg 3"));
+    assert(luaL_dostring(lua, "test({ \"a long enough string to be allocated\" }, 1.5)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "an integer expected at arg 2"));
+    assert(luaL_dostring(lua, "test({ \"a long enough string to be allocated\" })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "an integer expected at arg 2"));
+    assert(luaL_dostring(lua, "test({ \"a long enough string to be allocated\" }, 1, \"\", 4)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "wrong arguments number"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestOverloads {
+        static int32_t test(lua_State* lua) {
+            std::variant<
+                std::tuple<int32_t, std::string>,
+                std::tuple<std::vector<double>>,
+                std::tuple<std::string, std::optional<int32_t>>
+            > args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            lua_pushinteger(lua, static_cast<lua_Integer>(args.index()));
+            return 1;
+        }
+    };
+    lua_register(lua, "test", TestOverloads::test);
+    assert(luaL_dostring(lua, "return test(1, \"a\")") == LUA_OK);
+    assert(lua_tointeger(lua, -1) == 0);
+    lua_pop(lua, 1);
+    assert(luaL_dostring(lua, "return test({ 0.5 })") == LUA_OK);
+    assert(lua_tointeger(lua, -1) == 1);
+    lua_pop(lua, 1);
+    assert(luaL_dostring(lua, "return test(\"a\")") == LUA_OK);
+    assert(lua_tointeger(lua, -1) == 2);
+    lua_pop(lua, 1);
+    assert(luaL_dostring(lua, "return test(\"a\", 1)") == LUA_OK);
+    assert(lua_tointeger(lua, -1) == 2);
+    lua_pop(lua, 1);
+
+    assert(luaL_dostring(lua, "test(1)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "no matching signature"));
+
+    // The signature is chosen by the types, a wrong value is final.
+    assert(luaL_dostring(lua, "test(300000000000, \"a\")") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "value 300000000000 at arg 1 is out of int32_t range"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    lua_register(lua, "add", lua::cArgBind<&TestBind::add>());
+    lua_register(lua, "join", lua::cArgBind<&TestBind::join>());
+    lua_register(lua, "top", lua::cArgBind<&TestBind::top>());
+    assert(luaL_dostring(lua, "return add(1, 2), add(3)") == LUA_OK);
+    assert(lua_tointeger(lua, -2) == 3 && lua_tointeger(lua, -1) == 3);
+    lua_pop(lua, 2);
+    assert(luaL_dostring(lua, "return join({ \"a\", \"b\" }, \", \")") == LUA_OK);
+    assert(lua_tointeger(lua, -2) == 2 && std::string(lua_tostring(lua, -1)) == "a, b");
+    lua_pop(lua, 2);
+    // The arguments are left on the stack.
+    assert(luaL_dostring(lua, "top(\"topValue\") return topValue") == LUA_OK);
+    assert(lua_tointeger(lua, -1) == 1);
+    lua_pop(lua, 1);
+
+    assert(luaL_dostring(lua, "add(1, 2.5)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "an integer expected at arg 2"));
+    assert(luaL_dostring(lua, "add(1, 2, 3)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "wrong arguments number"));
+
+    // An error raised by the function itself does not leave the scratch in use,
+    // the next calls still reuse its vector.
+    lua_register(lua, "count", lua::cArgBind<&TestBind::count>());
+    assert(luaL_dostring(lua, "count({ 1, 2, 3 })") == LUA_OK);
+    assert(luaL_dostring(lua, "count({ })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "no values"));
+    lua_pop(lua, 1);
+    assert(luaL_dostring(lua, "count({ 1, 2, 3 })") == LUA_OK);
+    {
+        const size_t allocationsBefore = allocationsCount;
+        assert(luaL_dostring(lua, "return count({ 4, 5, 6 })") == LUA_OK);
+        assert(lua_tointeger(lua, -1) == 3 && allocationsCount == allocationsBefore);
+        lua_pop(lua, 1);
+    }
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    lua_register(lua, "dot", (lua::cArgBindYieldable<&TestBind::dot, 2>()));
+    // Not in a coroutine, the chunks are converted in one go.
+    assert(luaL_dostring(lua, "return dot({ 1, 2, 3 }, { 4, 5, 6 }, 1)") == LUA_OK);
+    assert(lua_tointeger(lua, -1) == 33);
+    lua_pop(lua, 1);
+    {
+        // In a coroutine, it yields between the chunks.
+        lua_State* thread = lua_newthread(lua);
+        assert(luaL_loadstring(thread, "return dot({ 1, 2, 3 }, { 4, 5, 6 })") == LUA_OK);
+        int32_t resultsNumber = 0;
+        int32_t yieldsNumber = 0;
+        int32_t status = lua_resume(thread, lua, 0, &resultsNumber);
+        while (status == LUA_YIELD) {
+            ++yieldsNumber;
+            lua_pop(thread, resultsNumber);
+            // Dropped by the binding.
+            lua_pushinteger(thread, 100);
+            status = lua_resume(thread, lua, 1, &resultsNumber);
+        }
+        assert(status == LUA_OK && yieldsNumber >= 2);
+        assert(resultsNumber == 1 && lua_tointeger(thread, -1) == 32);
+
+        assert(luaL_loadstring(thread, "return dot({ 1, 2, 3 }, { 4, \"5\", 6 })") == LUA_OK);
+        status = lua_resume(thread, lua, 0, &resultsNumber);
+        while (status == LUA_YIELD) {
+            lua_pop(thread, resultsNumber);
+            status = lua_resume(thread, lua, 0, &resultsNumber);
+        }
+        assert(status == LUA_ERRRUN);
+        assert(contains((lua_tostring(thread, -1)), "(an integer expected at arg -1 in arg 2[2])"));
+        lua_pop(lua, 1);
+    }
+    assert(luaL_dostring(lua, "dot({ 1, 2 }, 3)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "a table expected at arg 2"));
+    assert(luaL_dostring(lua, "dot({ 1, 2 }, { 1, nil, 3 })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "wrong key sequence"));
+    assert(luaL_dostring(lua, (std::string(sparse) +
+        "local b = sparse(40, 1) b[4096] = \"x\" dot({ 1, 2 }, b)").c_str()) != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "an integer expected at arg -1 in arg 2[4096]"));
+    assert(luaL_dostring(lua, (std::string(sparse) + "dot({ 1, 2 }, sparse(40, 1))").c_str())
+        != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "wrong key sequence in table at arg 2"));
+
+    lua_register(lua, "emit_batch", lua::cArgBindBatch<&TestBind::emit>());
+    assert(luaL_dostring(lua, "emitted = \"\" "
+        "local calls, errors = emit_batch({ { \"a\", 1.0, 2.0 }, { \"b\", 3.0 } }) "
+        "return calls, errors, emitted") == LUA_OK);
+    assert(lua_tointeger(lua, -3) == 2 && lua_isnil(lua, -2));
+    assert(std::string(lua_tostring(lua, -1)) == "a:3.000000;b:3.000000;");
+    lua_pop(lua, 3);
+    // The wrong rows are skipped and reported by their indexes.
+    assert(luaL_dostring(lua, "emitted = \"\" "
+        "local calls, errors = emit_batch({ { \"a\", 1.0 }, { \"b\", \"x\" }, 5, { \"c\", 2.0 }, "
+        "{ \"d\", 1.0, 2.0, 3.0 } }) "
+        "return calls, errors[2], errors[3], errors[5], emitted") == LUA_OK);
+    assert(lua_tointeger(lua, -5) == 2);
+    assert(contains((lua_tostring(lua, -4)), "a number expected at arg 2"));
+    assert(contains((lua_tostring(lua, -3)), "a table expected at arg -1 in arg 1[3]"));
+    assert(contains((lua_tostring(lua, -2)), "wrong arguments number"));
+    assert(std::string(lua_tostring(lua, -1)) == "a:1.000000;c:2.000000;");
+    lua_pop(lua, 5);
+    assert(luaL_dostring(lua, "emit_batch(1)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "a table expected at arg 1"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestPush {
+        struct Point {
+            double x = 0.0;
+            double y = 0.0;
+            std::optional<std::string> name;
+            static constexpr auto luaFields() {
+                return std::make_tuple(
+                    lua::LuaCArgParseField{ "x", &Point::x },
+                    lua::LuaCArgParseField{ "y", &Point::y },
+                    lua::LuaCArgParseField{ "name", &Point::name });
+            }
+            bool operator==(const Point& other) const {
+                return x == other.x && y == other.y && name == other.name;
+            }
+        };
+        struct Polyline {
+            std::vector<double> x;
+            std::vector<double> y;
+            static constexpr auto luaFields() {
+                return std::make_tuple(
+                    lua::LuaCArgParseField{ "x", &Polyline::x },
+                    lua::LuaCArgParseField{ "y", &Polyline::y });
+            }
+        };
+        using Args = std::tuple<
+            int32_t,
+            std::string,
+            std::vector<std::variant<int64_t, std::string>>,
+            std::map<std::string, std::vector<double>>,
+            std::vector<std::pair<int32_t, std::string>>,
+            lua::LuaCArgParseMatrix<float>,
+            lua::LuaCArgParseColumns<Polyline>,
+            Point,
+            std::optional<std::string>
+        >;
+        static int32_t test(lua_State* lua) {
+            // Pushed and parsed back.
+            Args pushed;
+            std::get<0>(pushed) = 7;
+            std::get<1>(pushed) = "str";
+            std::get<2>(pushed) = { 1, "two", 3 };
+            std::get<3>(pushed) = { { "a", { 0.5, 1.5 } }, { "b", { } } };
+            std::get<4>(pushed) = { { 1, "one" }, { 2, "two" } };
+            auto& matrix = std::get<5>(pushed);
+            matrix.rows = 2;
+            matrix.cols = 3;
+            matrix.data = { 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f };
+            std::get<6>(pushed).x = { 0.5, 1.5 };
+            std::get<6>(pushed).y = { 2.5, 3.5 };
+            std::get<7>(pushed) = { 0.5, 1.5, std::nullopt };
+            std::get<8>(pushed) = "tail";
+            if (lua::cArgPush(lua, pushed) != 9 || lua_gettop(lua) != 9) {
+                luaL_error(lua, "unexpected number of values");
+                return 0;
+            }
+            Args parsed;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, parsed, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            const auto& columns = std::get<6>(parsed);
+            if (std::get<0>(parsed) != 7 || std::get<1>(parsed) != "str"
+                    || std::get<2>(parsed) != std::get<2>(pushed)
+                    || std::get<3>(parsed) != std::get<3>(pushed)
+                    || std::get<4>(parsed) != std::get<4>(pushed)
+                    || std::get<5>(parsed).rows != 2 || std::get<5>(parsed).cols != 3
+                    || std::get<5>(parsed).data != matrix.data
+                    || columns.x != std::get<6>(pushed).x || columns.y != std::get<6>(pushed).y
+                    || !(std::get<7>(parsed) == std::get<7>(pushed))
+                    || std::get<8>(parsed) != std::get<8>(pushed)) {
+                luaL_error(lua, "unexpected round trip");
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestPush::test);
+    assert(luaL_dostring(lua, "test()") == LUA_OK);
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestParseOrRaise {
+        static int32_t test(lua_State* lua) {
+            std::tuple<int32_t, std::map<std::string, std::vector<int32_t>>> args;
+            lua::cArgParseOrRaise(lua, args);
+            lua_pushinteger(lua, std::get<0>(args)
+                + static_cast<int32_t>(std::get<1>(args).size()));
+            return 1;
+        }
+    };
+    lua_register(lua, "test", TestParseOrRaise::test);
+    assert(luaL_dostring(lua, "return test(1, { a = { 1 }, b = { } })") == LUA_OK);
+    assert(lua_tointeger(lua, -1) == 3);
+    lua_pop(lua, 1);
+
+    assert(luaL_dostring(lua, "test(1, { a = { 1, \"2\" } })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "bad argument #2 to 'test'"
+        " (an integer expected at arg -1 in arg 2[\"a\"][2])"));
+
+    assert(luaL_dostring(lua, "test(1)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "bad argument #2 to 'test' (a table expected at arg 2)"));
+
+    assert(luaL_dostring(lua, "test(1, { }, 3)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), ":1: wrong arguments number"));
+
+    struct TestParseOrRaiseStrings {
+        static int32_t test(lua_State* lua) {
+            std::tuple<std::string, std::vector<int32_t>> args;
+            lua::cArgParseOrRaise(lua, args);
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestParseOrRaiseStrings::test);
+    // Nothing of the parsed arguments is left behind by the raise.
+    {
+        const size_t liveBefore = allocationsCount - deallocationsCount;
+        assert(luaL_dostring(lua, "test(\"a string longer than the small buffer\", { 1, \"2\" })")
+            != LUA_OK);
+        assert(allocationsCount - deallocationsCount == liveBefore);
+        assert(contains((lua_tostring(lua, -1)), "bad argument #2 to 'test'"));
+        lua_pop(lua, 1);
+    }
+
+    struct TestParseOrRaiseArena {
+        static int32_t test(lua_State* lua) {
+            // Outlives the call, reset by its owner.
+            static std::byte buffer[4096];
+            static std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer),
+                std::pmr::null_memory_resource());
+            arena.release();
+            lua::LuaCArgParseOptions options;
+            options.memoryResource = &arena;
+            std::tuple<std::pmr::map<std::pmr::string, std::pmr::vector<int32_t>>> args(
+                std::allocator_arg, std::pmr::polymorphic_allocator<std::byte>(&arena));
+            lua::cArgParseOrRaise(lua, args, options);
+            lua_pushinteger(lua, static_cast<lua_Integer>(std::get<0>(args).size()));
+            return 1;
+        }
+    };
+    lua_register(lua, "test", TestParseOrRaiseArena::test);
+    assert(luaL_dostring(lua, "return test({ a = { 1 }, b = { 2, 3 } })") == LUA_OK);
+    assert(lua_tointeger(lua, -1) == 2);
+    lua_pop(lua, 1);
+    // The args constructed again before the raise take nothing from the heap,
+    // a raise repeated after the first one leaves the live allocations as is.
+    assert(luaL_dostring(lua, "test({ a = { 1, \"2\" } })") != LUA_OK);
+    lua_pop(lua, 1);
+    {
+        const size_t liveBefore = allocationsCount - deallocationsCount;
+        assert(luaL_dostring(lua, "test({ a = { 1, \"2\" } })") != LUA_OK);
+        assert(allocationsCount - deallocationsCount == liveBefore);
+        assert(contains((lua_tostring(lua, -1)), "bad argument #1 to 'test'"));
+        lua_pop(lua, 1);
+    }
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestSnapshot {
+        struct Point {
+            double x = 0.0;
+            static constexpr auto luaFields() {
+                return std::make_tuple(lua::LuaCArgParseField{ "x", &Point::x });
+            }
+            bool operator==(const Point& other) const {
+                return x == other.x;
+            }
+        };
+        using Args = std::tuple<int32_t, std::map<std::string, std::vector<double>>,
+            std::variant<int64_t, std::vector<std::string>>, Point, std::optional<double>>;
+        static int32_t test(lua_State* lua) {
+            // Made before anything is pushed, posted to a worker run below.
+            std::vector<std::function<void()>> tasks;
+            auto future = lua::cArgParseAsync<Args>(lua, [&tasks](std::function<void()> task) {
+                tasks.push_back(std::move(task));
+            });
+            lua::LuaCArgParseSnapshot<Args> snapshot;
+            lua::LuaCArgParseError snapshotError;
+            const bool isCaptured = lua::cArgSnapshot(lua, snapshot, snapshotError);
+            Args expected;
+            lua::LuaCArgParseError expectedError;
+            lua::LuaCArgParseOptions options;
+            options.keepArgs = true;
+            lua::cArgParse(lua, expected, expectedError, options);
+            // The same snapshot is built by several threads at once.
+            std::atomic<int32_t> matches = 0;
+            std::vector<std::thread> threads;
+            for (int32_t i = 0; isCaptured && i < 4; ++i) {
+                threads.emplace_back([&snapshot, &expected, &matches]() {
+                    for (int32_t j = 0; j < 50; ++j) {
+                        Args args;
+                        lua::cArgBuild(snapshot, args);
+                        if (args == expected) {
+                            ++matches;
+                        }
+                    }
+                });
+            }
+            threads.emplace_back([&tasks]() {
+                for (auto& task : tasks) {
+                    task();
+                }
+            });
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            const lua::LuaCArgParseResult<Args> result = future.get();
+            lua_pushinteger(lua, matches);
+            lua_pushboolean(lua, tasks.size() == (isCaptured ? 1 : 0)
+                && (!isCaptured || result.args == expected)
+                && result.error.toString() == expectedError.toString()
+                && snapshotError.toString() == expectedError.toString());
+            lua_pushstring(lua, expectedError.toString().c_str());
+            return 3;
+        }
+    };
+    lua_register(lua, "test", TestSnapshot::test);
+    // Shared and cyclic tables, the extra field is never walked.
+    assert(luaL_dostring(lua, "local shared = { 0.5 } local point = { x = 1.5 } point.self = point "
+        "return test(1, { a = shared, b = shared }, { \"x\", \"y\" }, point, 2.5)") == LUA_OK);
+    assert(lua_tointeger(lua, -3) == 200 && lua_toboolean(lua, -2));
+    assert(std::string_view(lua_tostring(lua, -1)).empty());
+    lua_pop(lua, 3);
+
+    assert(luaL_dostring(lua, "return test(1, { a = { 0.5, \"x\" } }, 2, { x = 0.5 })") == LUA_OK);
+    assert(lua_tointeger(lua, -3) == 0 && lua_toboolean(lua, -2));
+    assert(contains((lua_tostring(lua, -1)), "a number expected at arg -1 in arg 2[\"a\"][2]"));
+    lua_pop(lua, 3);
+
+    assert(luaL_dostring(lua, "return test(1, { }, 2, { x = 0.5 }, 0.5, 5)") == LUA_OK);
+    assert(lua_tointeger(lua, -3) == 0 && lua_toboolean(lua, -2));
+    assert(contains((lua_tostring(lua, -1)), "wrong arguments number"));
+    lua_pop(lua, 3);
+
+    assert(luaL_dostring(lua, "return test(1, { a = { 0.5 } }, { \"x\", 2 }, { x = 0.5 })") == LUA_OK);
+    assert(lua_tointeger(lua, -3) == 0 && lua_toboolean(lua, -2));
+    assert(contains((lua_tostring(lua, -1)), "a string expected at arg -1 in arg 3[2]"));
+    lua_pop(lua, 3);
+
+    // Only as deep as the arguments are declared.
+    assert(luaL_dostring(lua, "local t = { } for i = 1, 1000000 do t = { t } end "
+        "return test(1, { a = t }, { t }, { x = t })") == LUA_OK);
+    assert(lua_tointeger(lua, -3) == 0 && lua_toboolean(lua, -2));
+    assert(contains((lua_tostring(lua, -1)), "a number expected at arg -1 in arg 2[\"a\"][1]"));
+    lua_pop(lua, 3);
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestViews {
+        static int32_t test(lua_State* lua) {
+            std::tuple<lua::LuaCArgParseArrayView<int32_t>,
+                lua::LuaCArgParseMapView<std::string, std::vector<double>>,
+                lua::LuaCArgParseMapView<std::string_view, int32_t>> args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            const int32_t top = lua_gettop(lua);
+            const auto& array = std::get<0>(args);
+            const auto& map = std::get<1>(args);
+            lua::LuaCArgParseError error;
+            // Only the accessed elements are converted.
+            const int32_t* first = array.get(0, error);
+            const int32_t* cached = array.get(0, error);
+            if (array.size() != 3 || first == nullptr || *first != 1 || cached != first
+                    || array.get(3, error) != nullptr || !error.empty()) {
+                luaL_error(lua, "unexpected array view");
+                return 0;
+            }
+            if (array.get(2, error) != nullptr
+                    || error.toString() != "an integer expected at arg -1 in arg 1[3]") {
+                luaL_error(lua, "unexpected array view error");
+                return 0;
+            }
+            const std::vector<double>* a = map.find("a", error);
+            if (a == nullptr || *a != std::vector<double>{ 0.5, 1.5 }
+                    || map.find("c", error) != nullptr || !error.empty()) {
+                luaL_error(lua, "unexpected map view");
+                return 0;
+            }
+            size_t entries = 0;
+            if (map.forEach([&entries](const std::string&, const std::vector<double>&) {
+                        ++entries;
+                        return true;
+                    }, error)
+                    || error.toString() != "a number expected at arg -1 in arg 2[\"b\"][1]") {
+                luaL_error(lua, "unexpected map view error");
+                return 0;
+            }
+            // The cached keys don't point into the buffer of the caller.
+            char buffer[] = "alpha";
+            const auto& views = std::get<2>(args);
+            const int32_t* alpha = views.find(std::string_view(buffer), error);
+            std::char_traits<char>::copy(buffer, "omega", 5);
+            if (alpha == nullptr || *alpha != 7
+                    || views.find(std::string_view(buffer), error) != nullptr
+                    || views.find("alpha", error) != alpha) {
+                luaL_error(lua, "unexpected map view keys");
+                return 0;
+            }
+            if (lua_gettop(lua) != top) {
+                luaL_error(lua, "unbalanced stack");
+                return 0;
+            }
+            return 0;
+        }
+    };
+    lua_register(lua, "test", TestViews::test);
+    assert(luaL_dostring(lua, "test({ 1, 2, \"3\" }, { a = { 0.5, 1.5 }, b = { \"x\" } }, { alpha = 7 })") == LUA_OK);
+
+    assert(luaL_dostring(lua, "test(1, { }, { })") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "a table expected at arg 1"));
+
+    struct TestViewInOverloads {
+        static int32_t ov(lua_State* lua) {
+            std::variant<std::tuple<lua::LuaCArgParseArrayView<int32_t>>,
+                std::tuple<int32_t>> args;
+            std::string errorStr;
+            if (!lua::cArgParse(lua, args, errorStr)) {
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            if (const auto* view = std::get_if<0>(&args)) {
+                // The table of the view is left on the stack.
+                lua::LuaCArgParseError error;
+                const int32_t* last = std::get<0>(*view).get(2, error);
+                lua_pushinteger(lua, last != nullptr ? *last : -1);
+                return 1;
+            }
+            lua_pushinteger(lua, std::get<0>(std::get<1>(args)));
+            return 1;
+        }
+    };
+    lua_register(lua, "ov", TestViewInOverloads::ov);
+    assert(luaL_dostring(lua, "return ov({ 5, 6, 7 }), ov(8)") == LUA_OK);
+    assert(lua_tointeger(lua, -2) == 7 && lua_tointeger(lua, -1) == 8);
+    lua_pop(lua, 2);
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
+    struct TestForEach {
+        static int32_t test(lua_State* lua) {
+            const int64_t limit = luaL_checkinteger(lua, 2);
+            int64_t sum = 0;
+            lua::LuaCArgParseError error;
+            const lua::LuaCArgForEachResult result =
+                lua::cArgForEach<std::variant<int64_t, std::string_view>>(lua, 1,
+                [&sum, limit](const std::variant<int64_t, std::string_view>& value) {
+                    if (const int64_t* integer = std::get_if<int64_t>(&value)) {
+                        sum += *integer;
+                    }
+                    else {
+                        sum += static_cast<int64_t>(std::get<std::string_view>(value).size());
+                    }
+                    return sum < limit;
+                }, error);
+            if (result == lua::LuaCArgForEachResult::Failed) {
+                std::string errorStr;
+                error.toString(errorStr);
+                luaL_error(lua, errorStr.c_str());
+                return 0;
+            }
+            lua_pushinteger(lua, sum);
+            lua_pushboolean(lua, result == lua::LuaCArgForEachResult::Completed);
+            return 2;
+        }
+    };
+    lua_register(lua, "test", TestForEach::test);
+    assert(luaL_dostring(lua, "return test({ 1, 2, \"str\", 4 }, 100)") == LUA_OK);
+    assert(lua_tointeger(lua, -2) == 10 && lua_toboolean(lua, -1));
+    lua_pop(lua, 2);
+
+    // Stopped by the callback.
+    assert(luaL_dostring(lua, "return test({ 1, 2, \"str\", 4 }, 3)") == LUA_OK);
+    assert(lua_tointeger(lua, -2) == 3 && !lua_toboolean(lua, -1));
+    lua_pop(lua, 2);
+
+    assert(luaL_dostring(lua, "return test({ 1, 2, 0.5 }, 100)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "no suitable variant in arg 1[3]"));
+
+    assert(luaL_dostring(lua, "return test(1, 100)") != LUA_OK);
+    assert(contains((lua_tostring(lua, -1)), "a table expected at arg 1"));
+
+    // =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=
+
     lua_close(lua);
     std::cout << "success" << std::endl;
     return 0;